@@ -19,31 +19,56 @@ limitations under the License.
 #include <eosio/multi_index.hpp>
 #include <eosio/action.hpp>
 #include <eosio/transaction.hpp>
+#include <eosio/singleton.hpp>
 #include <eosio/asset.hpp>
 #include <eosio/crypto.hpp>
 #include <eosio/time.hpp>
 
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string_view>
+#include <tuple>
+
 #include "escrowescrow_constants.hpp"
+#include "escrowescrow_lifecycle.hpp"
 
 using namespace eosio;
 
 using std::string;
+using std::string_view;
 using std::to_string;
+using std::vector;
 
 CONTRACT escrowescrow : public eosio::contract {
  public:
   escrowescrow( name self, name code, datastream<const char*> ds ):
     contract(self, code, ds),
-    _deals(self, self.value)
+    _deals(self, self.value),
+    _texts(self, self.value),
+    _templates(self, self.value),
+    _policies(self, self.value),
+    _subscriptions(self, self.value),
+    _arbstats(self, self.value),
+    _checkpoints(self, self.value),
+    _tmconf(self, self.value)
       {}
 
-  const uint16_t BUYER_ACCEPTED_FLAG    = 1 << 0;
-  const uint16_t SELLER_ACCEPTED_FLAG   = 1 << 1;
-  const uint16_t DEAL_FUNDED_FLAG       = 1 << 2;
-  const uint16_t DEAL_DELIVERED_FLAG    = 1 << 3;
-  const uint16_t DEAL_ARBITRATION_FLAG  = 1 << 4;
+  // telemetry changes of the action are written once, at the end
+  ~escrowescrow()
+  {
+    if( _tm_dirty ) {
+      _tm.actions++;
+      _tmconf.set(_tm, _self);
+    }
+    if( _cp_dirty ) {
+      _save_checkpoint();
+    }
+  }
 
-  const uint16_t BOTH_ACCEPTED_FLAG = BUYER_ACCEPTED_FLAG | SELLER_ACCEPTED_FLAG;
+  const uint8_t TOKENS_OPEN    = 0; // any token the buyer has a balance of
+  const uint8_t TOKENS_LISTED  = 1; // registered tokens the buyer has a balance of
+  const uint8_t TOKENS_STRICT  = 2; // registered tokens, buyer balance not checked
   
 
   ACTION setarbiter(name account, string contact_name, string email, string description,
@@ -52,13 +77,7 @@ CONTRACT escrowescrow : public eosio::contract {
     require_auth(account);
     check(contact_name.length() > 0, "Contact name cannot be empty");
     check(email.length() > 0, "Email cannot be empty");
-    if( iso_country.length() > 0 ) {
-      check(iso_country.length() == 2, "ISO country code must be 2 letters");
-      for( int i = 0; i < iso_country.length(); i++ ) {
-        char c = iso_country[i];
-        check('A' <= c && c <= 'Z', "Invalid character in ISO country code");
-      }
-    }
+    const uint16_t country = _country_code(iso_country);
 
     auto setter = [&]( auto& item ) {
       item.account = account;
@@ -73,93 +92,335 @@ CONTRACT escrowescrow : public eosio::contract {
           
     arbiters _arbiters(_self, _self.value);
     auto arbitr = _arbiters.find(account.value);
+    uint32_t processed_deals = 0;
     if( arbitr == _arbiters.end() ) {
       _arbiters.emplace(account, setter);
     }
     else {
+      processed_deals = arbitr->processed_deals;
       _arbiters.modify(*arbitr, account, setter);
     }
+
+    auto statitr = _arbstats.find(account.value);
+    if( statitr == _arbstats.end() ) {
+      _arbstats.emplace(account, [&]( auto& item ) {
+          item.account = account;
+          item.is_active = 1;
+          item.country = country;
+          item.processed_deals = processed_deals;
+        });
+    }
+    else if( !statitr->is_active || statitr->country != country ) {
+      _arbstats.modify(*statitr, same_payer, [&]( auto& item ) {
+          item.is_active = 1;
+          item.country = country;
+        });
+    }
   }
 
   
   ACTION delarbiter(name account)
   {
     require_auth(account);
-    arbiters _arbiters(_self, _self.value);
-    auto arbitr = _arbiters.find(account.value);
-    check(arbitr != _arbiters.end(), "Cannot find the arbiter");
-    check(arbitr->is_active, "This arbiter is already marked for deletion");
-    _arbiters.modify(*arbitr, account, [&]( auto& item ) {
-        item.is_active = 0;
-      });
+    const arbstat& st = _arbiter_stat(account);
+    // also deletes an arbiter left retired with no open deals, such as
+    // one retired before the upgrade
+    if( st.open_deals == 0 && !_arbiter_has_old_deals(account) ) {
+      _delete_arbiter(account);
+    }
+    else {
+      check(st.is_active, "This arbiter is already marked for deletion");
+      _arbstats.modify(st, same_payer, [&]( auto& item ) {
+          item.is_active = 0;
+        });
+      // keep the profile and its active index in line for table readers
+      arbiters _arbiters(_self, _self.value);
+      _arbiters.modify(_arbiters.get(account.value), same_payer, [&]( auto& item ) {
+          item.is_active = 0;
+        });
+    }
   }
 
+
   
+  // deal parameters, as given to newdeal
+  struct dealspec {
+    string      description;
+    name        tkcontract;
+    asset       quantity;
+    name        buyer;
+    name        seller;
+    name        arbiter;
+    uint32_t    days;
+  };
+
   ACTION newdeal(name creator, string description, name tkcontract, asset& quantity,
                  name buyer, name seller, name arbiter, uint32_t days)
   {
     require_auth(creator);
+    const dealspec spec {
+      .description=std::move(description), .tkcontract=tkcontract, .quantity=quantity,
+      .buyer=buyer, .seller=seller, .arbiter=arbiter, .days=days };
+
+    deal_checks checks;
+    _validate_deal(checks, spec);
+
+    bool legacy;
+    uint64_t id = _reserve_deal_ids(1, legacy);
+    if( legacy ) {
+      id = _free_legacy_id(id);
+    }
+    _create_deal(checks, creator, id, spec);
+    _sweep_expired();
+  }
+
+
+  // Create many deals at once. Accounts, buyer balances and arbiters that
+  // repeat across the batch are validated only once.
+  ACTION newdeals(name creator, vector<dealspec> deals)
+  {
+    require_auth(creator);
+    check(deals.size() > 0, "deals list cannot be empty");
+
+    deal_checks checks;
+    for( const auto& spec : deals ) {
+      _validate_deal(checks, spec);
+    }
+
+    bool legacy;
+    uint64_t first_id = _reserve_deal_ids(deals.size(), legacy);
+    for( uint32_t i = 0; i < deals.size(); i++ ) {
+      _create_deal(checks, creator, legacy ? _free_legacy_id(first_id + i) : first_id + i, deals[i]);
+    }
+    _sweep_expired();
+  }
+
+
+  // payment tranche of a milestone deal, due within days from the
+  // release of the previous one
+  struct milestone {
+    asset          amount;
+    uint32_t       days;
+  };
+
+  // Create a deal paid in tranches. The buyer funds the total at once,
+  // and each goods received releases the amount of the current milestone
+  // to the seller and starts the term of the next one.
+  ACTION newmsdeal(name creator, string description, name tkcontract, name buyer,
+                   name seller, name arbiter, vector<milestone> milestones)
+  {
+    require_auth(creator);
+    check(milestones.size() >= 2, "a milestone deal needs at least 2 milestones");
+    check(milestones.size() <= MAX_MILESTONES, "too many milestones");
+    asset total(0, milestones[0].amount.symbol);
+    uint32_t max_days = 0;
+    for( const auto& m : milestones ) {
+      check(m.amount.symbol == total.symbol, "all milestones must be in the same token");
+      check(m.amount.is_valid() && m.amount.amount > 0, "milestone amount must be positive");
+      check(m.days > 0, "milestone term should be a positive number of days");
+      total += m.amount;
+      max_days = std::max(max_days, m.days);
+    }
+    // the longest term is validated, the first one is set at creation
+    const dealspec spec {
+      .description=std::move(description), .tkcontract=tkcontract, .quantity=total,
+      .buyer=buyer, .seller=seller, .arbiter=arbiter, .days=max_days };
+
+    deal_checks checks;
+    _validate_deal(checks, spec);
+
+    bool legacy;
+    uint64_t id = _reserve_deal_ids(1, legacy);
+    if( legacy ) {
+      id = _free_legacy_id(id);
+    }
+    _create_deal(checks, creator, id, spec, 0, name(), &milestones);
+    _sweep_expired();
+  }
+
+
+  // Register the shared terms of repeat deals. Templates are addressed
+  // by content: the ID is derived from the terms, and registering the
+  // same terms again returns the existing ID.
+  [[eosio::action]]
+  uint64_t newtemplate(name owner, string description, name tkcontract, symbol sym,
+                       uint32_t days, name arbiter)
+  {
+    require_auth(owner);
     check(description.length() > 0, "description cannot be empty");
+    check(sym.is_valid(), "invalid symbol");
+    check(days > 0, "delivery term should be a positive number of days");
     check(is_account(tkcontract), "tkcontract account does not exist");
-    check(quantity.is_valid(), "invalid quantity" );
-    check(quantity.amount > 0, "must specify a positive quantity" );
-    check(is_account(buyer), "buyer account does not exist");
-    check(is_account(seller), "seller account does not exist");
     check(is_account(arbiter), "arbiter account does not exist");
-    check(buyer != seller && buyer != arbiter && seller != arbiter,
-                 "Buyer, seller and arbiter must be different accounts");
-    
-    check(days > 0, "delivery term should be a positive number of days");
 
-    // Validate the token contract. The buyer should have a non-zero balance of payment token
-    accounts token_accounts(tkcontract, buyer.value);
-    const auto token_name = quantity.symbol.code().raw();
-    auto token_accounts_itr = token_accounts.find(token_name);
-    check(token_accounts_itr != token_accounts.end() && token_accounts_itr->balance.amount > 0,
-                 "Invalid currency or the buyer has no funds");
-
-    // Check that arbiter is active
-    arbiters _arbiters(_self, _self.value);
-    auto arb = _arbiters.get(arbiter.value, "Cannot find the arbiter");
-    check(arb.is_active, "This arbiter marked as inactive");
-    
-    // deal ID is first 32 bits from transaction ID
-    uint64_t id = 0;
-    auto size = transaction_size();
-    char buf[size];
-    uint32_t read = read_transaction( buf, size );
-    check( size == read, "read_transaction failed");
-    checksum256 h = sha256(buf, size);
-    auto hbytes = h.extract_as_byte_array();
-    for(int i=0; i<4; i++) {
-      id <<=8;
-      id |= hbytes[i];
+    uint64_t id = _template_hash(description, tkcontract, sym, days, arbiter);
+    for(;;) {
+      auto itr = _templates.find(id);
+      if( itr == _templates.end() ) {
+        break;
+      }
+      if( itr->description == description && itr->tkcontract == tkcontract &&
+          itr->sym == sym && itr->days == days && itr->arbiter == arbiter ) {
+        return id;
+      }
+      id++;
     }
 
-    auto idx = _deals.emplace(creator, [&]( auto& d ) {
-        d.id = id;
-        d.created_by = creator;
-        d.description = description;
-        d.price.contract = tkcontract;
-        d.price.quantity = quantity;
-        d.buyer = buyer;
-        d.seller = seller;
-        d.arbiter = arbiter;
-        d.days = days;
-        d.expires = time_point_sec(current_time_point()) + NEW_DEAL_EXPIRES;
-        d.flags = 0;
-        if( creator == buyer ) {
-          d.flags |= BUYER_ACCEPTED_FLAG;
-        } else if ( creator == seller ) {
-          d.flags |= SELLER_ACCEPTED_FLAG;
-        }
+    _templates.emplace(owner, [&]( auto& t ) {
+        t.id = id;
+        t.owner = owner;
+        t.description = std::move(description);
+        t.tkcontract = tkcontract;
+        t.sym = sym;
+        t.days = days;
+        t.arbiter = arbiter;
+        t.refs = 0;
       });
-    _notify(name("new"), "New deal created", *idx);
-    
-    require_recipient(buyer);
-    require_recipient(seller);
-    require_recipient(arbiter);
-    _clean_expired_deals(id);
+    return id;
+  }
+
+
+  // Remove a template that no open deal refers to. Templates that were
+  // used are removed automatically when their last deal closes.
+  ACTION deltemplate(uint64_t template_id)
+  {
+    const dealtemplate& t = _templates.get(template_id, "Cannot find the template");
+    require_auth(t.owner);
+    check(t.refs == 0, "The template is used by open deals");
+    _templates.erase(t);
+  }
+
+
+  // Create a deal from a template. days of zero takes the template term.
+  ACTION newdealtpl(name creator, uint64_t template_id, asset& quantity,
+                    name buyer, name seller, uint32_t days)
+  {
+    require_auth(creator);
+    const dealtemplate& tpl = _templates.get(template_id, "Cannot find the template");
+    check(quantity.symbol == tpl.sym, "Quantity symbol does not match the template");
+    const dealspec spec {
+      .tkcontract=tpl.tkcontract, .quantity=quantity, .buyer=buyer, .seller=seller,
+      .arbiter=tpl.arbiter, .days=(days > 0 ? days : tpl.days) };
+
+    deal_checks checks;
+    _validate_deal(checks, spec, true);
+
+    bool legacy;
+    uint64_t id = _reserve_deal_ids(1, legacy);
+    if( legacy ) {
+      id = _free_legacy_id(id);
+    }
+    _templates.modify(tpl, same_payer, [&]( auto& item ) {
+        item.refs++;
+      });
+    _create_deal(checks, creator, id, spec, template_id);
+    _sweep_expired();
+  }
+
+
+  // token and price range accepted by a seller policy, in the smallest
+  // units of the token (0 for no limit)
+  struct policytoken {
+    name           contract;
+    symbol         sym;
+    int64_t        min_amount;
+    int64_t        max_amount;
+  };
+
+  // Standing acceptance by the seller: deals created by others in one of
+  // the listed tokens, with one of the listed arbiters (any arbiter if
+  // the list is empty) and a delivery term up to max_days (0 for no
+  // limit) are accepted on behalf of the seller when they are created
+  ACTION setpolicy(name seller, vector<policytoken> tokens, vector<name> arbiters, uint32_t max_days)
+  {
+    require_auth(seller);
+    check(tokens.size() > 0, "tokens list cannot be empty");
+    for( const auto& t : tokens ) {
+      check(t.sym.is_valid(), "invalid symbol");
+      check(t.min_amount >= 0 && t.max_amount >= 0, "amount limits cannot be negative");
+      check(t.max_amount == 0 || t.max_amount >= t.min_amount,
+            "max_amount cannot be less than min_amount");
+    }
+
+    auto setter = [&]( auto& item ) {
+      item.seller = seller;
+      item.tokens = std::move(tokens);
+      item.arbiters = std::move(arbiters);
+      item.max_days = max_days;
+    };
+
+    auto itr = _policies.find(seller.value);
+    if( itr == _policies.end() ) {
+      _policies.emplace(seller, setter);
+    }
+    else {
+      _policies.modify(*itr, seller, setter);
+    }
+  }
+
+
+  ACTION delpolicy(name seller)
+  {
+    require_auth(seller);
+    _policies.erase(_policies.get(seller.value, "This seller has no policy"));
+  }
+
+
+  // Switch between sequential deal IDs and legacy IDs taken from the
+  // first 32 bits of the transaction ID
+  ACTION legacyids(bool enable)
+  {
+    require_auth(_self);
+    props _props(_self, _self.value);
+    _set_prop(_props, name("legacyids"), enable ? 1 : 0);
+  }
+
+
+  // Add a token to the registry or change its deal size limits.
+  // Limits are in the smallest units of the token, 0 for no limit.
+  ACTION settoken(name contract, symbol sym, int64_t min_amount, int64_t max_amount)
+  {
+    require_auth(_self);
+    check(is_account(contract), "token contract account does not exist");
+    check(sym.is_valid(), "invalid symbol");
+    check(min_amount >= 0 && max_amount >= 0, "deal size limits cannot be negative");
+    check(max_amount == 0 || max_amount >= min_amount, "max_amount cannot be less than min_amount");
+
+    auto setter = [&]( auto& item ) {
+      item.sym = sym;
+      item.min_amount = min_amount;
+      item.max_amount = max_amount;
+    };
+
+    tokens _tokens(_self, contract.value);
+    auto tkitr = _tokens.find(sym.code().raw());
+    if( tkitr == _tokens.end() ) {
+      _tokens.emplace(_self, setter);
+    }
+    else {
+      _tokens.modify(*tkitr, _self, setter);
+    }
+  }
+
+
+  // Remove a token from the registry. In listed and strict modes, deals
+  // in this token can no longer be created or funded
+  ACTION deltoken(name contract, symbol_code code)
+  {
+    require_auth(_self);
+    tokens _tokens(_self, contract.value);
+    _tokens.erase(_tokens.get(code.raw(), "This token is not in the registry"));
+  }
+
+
+  // Token validation mode for new deals and payments: 0 = open,
+  // 1 = listed, 2 = strict
+  ACTION tokenmode(uint8_t mode)
+  {
+    require_auth(_self);
+    check(mode <= TOKENS_STRICT, "Invalid token mode");
+    props _props(_self, _self.value);
+    _set_prop(_props, name("tokenmode"), mode);
   }
 
   
@@ -170,154 +431,154 @@ CONTRACT escrowescrow : public eosio::contract {
     auto dealitr = _deals.find(deal_id);
     check(dealitr != _deals.end(), "Cannot find deal_id");
     const deal& d = *dealitr;
-    auto flags = d.flags;
 
-    check(d.expires > time_point_sec(current_time_point()), "The deal is expired");
-    
+    bool reported = false;
     if( party == d.buyer ) {
-      check( (d.flags & BUYER_ACCEPTED_FLAG) == 0, "Buyer has already accepted this deal");
-      flags |= BUYER_ACCEPTED_FLAG;
-    } else if (party == d.seller ) {
-      check( (d.flags & SELLER_ACCEPTED_FLAG) == 0, "Seller has already accepted this deal");
-      flags |= SELLER_ACCEPTED_FLAG;
+      _check_transition<T_BUYER_ACCEPT>(d, party);
+      reported = _apply_transition<T_BUYER_ACCEPT>(d, party);
+    } else if( party == d.seller ) {
+      _check_transition<T_SELLER_ACCEPT>(d, party);
+      reported = _apply_transition<T_SELLER_ACCEPT>(d, party);
     } else {
-      check(false, "Deal can only be accepted by either seller or buyer");
+      check(d.expires > time_point_sec(current_time_point()), "The deal is expired");
+      check(false, TRANSITIONS[T_SELLER_ACCEPT].party_error);
     }
-      
-    if( (flags & BOTH_ACCEPTED_FLAG) == BOTH_ACCEPTED_FLAG ) {
-      _deals.modify( *dealitr, party, [&]( auto& item ) {
-          item.flags = flags;
-          item.expires = time_point_sec(current_time_point()) + ACCEPTED_DEAL_EXPIRES;
-        });
+    if( reported ) {
       _notify(name("accepted"), "Deal is fully accepted", d);
-      require_recipient(d.seller);
-      require_recipient(d.buyer);
-    }
-    else {
-      _deals.modify( *dealitr, party, [&]( auto& item ) {
-          item.flags = flags;
-        });
+      _require_recipient(d.seller, EVENTS_ACCEPTED);
+      _require_recipient(d.buyer, EVENTS_ACCEPTED);
     }
 
-    _clean_expired_deals(deal_id);
+    _sweep_expired();
   }
 
 
   
-  // Accept funds for a deal
+  // Accept funds for a deal, or for several deals listed in memo separated by commas
   [[eosio::on_notify("*::transfer")]]
-    void transfer_handler (name from, name to, asset quantity, string memo) {
+    void transfer_handler (name from, name to, asset quantity, const string& memo) {
     if(to == _self) {
       check(memo.length() > 0, "Memo must contain a valid deal ID");
-      
+
+      const extended_asset payment(quantity, name{get_first_receiver()});
+      if( _get_token_mode() != TOKENS_OPEN ) {
+        _get_token(payment.contract, quantity.symbol);
+      }
+
+      // a new deal, created by the buyer and funded by this transfer
+      const string_view params(memo);
+      if( params.substr(0, 5) == "deal:" || params.substr(0, 4) == "tpl:" ) {
+        _create_funded_deal(from, payment, params);
+        _ledger_update(payment, true);
+        _sweep_expired();
+        return;
+      }
+
+      int64_t total = 0;
+      const deal* first = nullptr;
+      auto fund = [&]( uint64_t id ) {
+        const deal& d = _fund_deal(from, id, payment);
+        total += d.price.quantity.amount;
+        check(total <= asset::max_amount, "Total amount of deals in memo is too large");
+        if( first == nullptr ) {
+          first = &d;
+        }
+      };
+
+      // deals are funded as their IDs are parsed
       uint64_t deal_id = 0;
-      for( int i = 0; i < memo.length(); i++ ) {
-        char c = memo[i];
+      bool has_digits = false;
+      for( char c : memo ) {
+        if( c == ',' ) {
+          check(has_digits, "Empty deal ID in memo");
+          fund(deal_id);
+          deal_id = 0;
+          has_digits = false;
+          continue;
+        }
         check('0' <= c && c <= '9', "Invalid character in memo. Expected only digits");
+        check(deal_id <= (UINT64_MAX - (c - '0')) / 10, "Deal ID in memo is too large");
         deal_id *= 10;
         deal_id += (c - '0');
+        has_digits = true;
       }
-      
-      auto dealitr = _deals.find(deal_id);
-      check(dealitr != _deals.end(), (string("Cannot find deal ID: ") + to_string(deal_id)).c_str());
-      const deal& d = *dealitr;
-
-      check(d.expires > time_point_sec(current_time_point()), "The deal is expired");
+      check(has_digits, "Empty deal ID in memo");
+      fund(deal_id);
 
-      check((d.flags & DEAL_FUNDED_FLAG) == 0, "The deal is already funded");
-      check((d.flags & BOTH_ACCEPTED_FLAG) == BOTH_ACCEPTED_FLAG,
-                   "The deal is not accepted yet by both parties");
-      check(from == d.buyer, "The deal can only funded by buyer");      
-      const extended_asset payment(quantity, name{get_first_receiver()});
-
-      check(payment == d.price,
-                   (string("Invalid amount or currency. Expected ") +
-                    d.price.quantity.to_string() + " via " + d.price.contract.to_string()).c_str());
-      _deals.modify( *dealitr, _self, [&]( auto& item ) {
-          item.funded = time_point_sec(current_time_point());
-          item.expires = item.funded + (item.days * DAY_SEC);
-          item.flags |= DEAL_FUNDED_FLAG;
+      _check(total == payment.quantity.amount, [&] {
+          return "Invalid amount or currency. Expected " +
+            asset(total, first->price.quantity.symbol).to_string() +
+            " via " + first->price.contract.to_string();
         });
-      
-      _notify(name("funded"), "Deal is funded", d);
-      require_recipient(d.seller);
-      _clean_expired_deals(deal_id);
+      _ledger_update(payment, true);
+      _sweep_expired();
     }
   }
 
   
   ACTION cancel(uint64_t deal_id)
   {
-    auto dealitr = _deals.find(deal_id);
-    check(dealitr != _deals.end(), "Cannot find deal_id");
-    const deal& d = *dealitr;
+    payouts pay;
+    _cancel_deal(deal_id, pay);
+    _send_payouts(pay);
+    _sweep_expired();
+  }
 
-    check((d.flags & DEAL_ARBITRATION_FLAG) == 0, "The deal is in arbitration");
-    check(d.expires > time_point_sec(current_time_point()), "The deal is expired");
-    
-    if( (d.flags & DEAL_FUNDED_FLAG) == 0 ) {
-      // not funded, so any of the parties can cancel the deal
-      check(has_auth(d.buyer) || has_auth(d.seller),
-                   "Only seller or buyer can cancel the deal");
-    }
-    else {
-      check((d.flags & DEAL_DELIVERED_FLAG) == 0, "The deal is already delivered, cannot cancel");
-      // funded, so only seller can cancel the deal
-      check(has_auth(d.seller), "The deal is funded, so only seller can cancel it");
-      _send_payment(d.buyer, d.price,
-                    string("Deal ") + to_string(d.id) + ": canceled by seller");
-      _notify(name("refunded"), "Deal canceled by seller, buyer got refunded", d);
+
+  // Cancel several deals. Refunds to the same buyer in the same token
+  // are added up into one transfer
+  ACTION cancels(vector<uint64_t> deal_ids)
+  {
+    check(deal_ids.size() > 0, "deal_ids list cannot be empty");
+    payouts pay;
+    for( uint64_t deal_id : deal_ids ) {
+      _cancel_deal(deal_id, pay);
     }
-    
-    _notify(name("canceled"), "The deal is canceled", d);    
-    _deals.erase(dealitr);
-    _clean_expired_deals(deal_id);
+    _send_payouts(pay);
+    _sweep_expired();
   }
 
   
   
-  ACTION delivered(uint64_t deal_id, string memo)
+  ACTION delivered(uint64_t deal_id, const string& memo)
   {
     auto dealitr = _deals.find(deal_id);
     check(dealitr != _deals.end(), "Cannot find deal_id");
     const deal& d = *dealitr;
 
-    check(d.expires > time_point_sec(current_time_point()), "The deal is expired");
-    
-    check((d.flags & DEAL_FUNDED_FLAG), "The deal is not funded yet");
-    check((d.flags & DEAL_DELIVERED_FLAG) == 0, "The deal is already marked as delivered");
-    check(has_auth(d.seller), "Only seller can mark a deal as delivered");
-
-    _deals.modify( *dealitr, d.seller, [&]( auto& item ) {
-        item.expires = time_point_sec(current_time_point()) + DELIVERED_DEAL_EXPIRES;
-        item.flags |= DEAL_DELIVERED_FLAG;
+    _check_transition<T_DELIVER>(d);
+    _apply_transition<T_DELIVER>(d, d.seller);
+    _texts.modify( _texts.get(deal_id), d.seller, [&]( auto& item ) {
         item.delivery_memo = memo;
       });
 
     _notify(name("delivered"), "Deal is marked as delivered", d);
-    require_recipient(d.buyer);
-    _clean_expired_deals(deal_id);
+    _require_recipient(d.buyer, EVENTS_DELIVERED);
+    _sweep_expired();
   }
 
 
   // Goods Received may be made before "delivered", but the deal must be funded first
   ACTION goodsrcvd(uint64_t deal_id)
   {
-    auto dealitr = _deals.find(deal_id);
-    check(dealitr != _deals.end(), "Cannot find deal_id");
-    const deal& d = *dealitr;
+    payouts pay;
+    _goods_received(deal_id, pay);
+    _send_payouts(pay);
+    _sweep_expired();
+  }
 
-    check((d.flags & DEAL_FUNDED_FLAG), "The deal is not funded yet");
-    check(has_auth(d.buyer), "Only buyer can sign-off Goods Received");
 
-    _send_payment(d.seller, d.price,
-                  string("Deal ") + to_string(d.id) + ": goods received, deal closed");
-    _notify(name("closed"), "Goods received, deal closed", d);
-    if( d.flags & DEAL_ARBITRATION_FLAG ) {
-      require_recipient(d.arbiter);
+  // Sign off goods received for several deals. Payments to the same
+  // seller in the same token are added up into one transfer
+  ACTION goodsrcvds(vector<uint64_t> deal_ids)
+  {
+    check(deal_ids.size() > 0, "deal_ids list cannot be empty");
+    payouts pay;
+    for( uint64_t deal_id : deal_ids ) {
+      _goods_received(deal_id, pay);
     }
-    _deals.erase(dealitr);    
-    _clean_expired_deals(deal_id);
+    _send_payouts(pay);
+    _sweep_expired();
   }
 
 
@@ -328,115 +589,66 @@ CONTRACT escrowescrow : public eosio::contract {
     check(dealitr != _deals.end(), "Cannot find deal_id");
     const deal& d = *dealitr;
 
-    check(d.expires > time_point_sec(current_time_point()), "The deal is expired");
-
-    check((d.flags & DEAL_FUNDED_FLAG), "The deal is not funded yet");
-    check(has_auth(d.buyer), "Only buyer can extend a deal");
-
-    _deals.modify( *dealitr, _self, [&]( auto& item ) {
+    _check_transition<T_EXTEND>(d);
+    _apply_transition<T_EXTEND>(d, _self, [&]( auto& item ) {
         item.days += moredays;
-        item.expires = item.funded + (item.days * DAY_SEC);
-        });
+      });
 
     _notify(name("extended"), "Deal extended by " + to_string(moredays) + " more days", d);
-    require_recipient(d.seller);
-    _clean_expired_deals(deal_id);
+    _require_recipient(d.seller, EVENTS_FUNDED);
+    _sweep_expired();
   }
 
 
 
   ACTION arbrefund(uint64_t deal_id)
   {
-    auto dealitr = _deals.find(deal_id);
-    check(dealitr != _deals.end(), "Cannot find deal_id");
-    const deal& d = *dealitr;
-
-    check((d.flags & DEAL_ARBITRATION_FLAG), "The deal is not open for arbitration");
-    require_auth(d.arbiter);
-
-    arbiters _arbiters(_self, _self.value);
-    auto arbitr = _arbiters.find(d.arbiter.value);
-    check(arbitr != _arbiters.end(), "Cannot find the arbiter");
-    _arbiters.modify(*arbitr, _self, [&]( auto& item ) {
-        item.processed_deals++;
-      });
-    
-    _send_payment(d.buyer, d.price,
-                  string("Deal ") + to_string(d.id) + ": canceled by arbitration");
-    _notify(name("arbrefund"), "Deal canceled by arbitration, buyer got refunded", d);
-    require_recipient(d.seller);
-    _deals.erase(dealitr);
-    _clean_expired_deals(deal_id);
+    _arbitrate(deal_id, name("arbrefund"));
   }
   
 
   
   ACTION arbenforce(uint64_t deal_id)
   {
-    auto dealitr = _deals.find(deal_id);
-    check(dealitr != _deals.end(), "Cannot find deal_id");
-    const deal& d = *dealitr;
+    _arbitrate(deal_id, name("arbenforce"));
+  }
 
-    check((d.flags & DEAL_ARBITRATION_FLAG), "The deal is not open for arbitration");
-    require_auth(d.arbiter);
 
-    arbiters _arbiters(_self, _self.value);
-    auto arbitr = _arbiters.find(d.arbiter.value);
-    check(arbitr != _arbiters.end(), "Cannot find the arbiter");
-    _arbiters.modify(*arbitr, _self, [&]( auto& item ) {
-        item.processed_deals++;
-      });
-    
-    _send_payment(d.seller, d.price,
-                  string("Deal ") + to_string(d.id) + ": enforced by arbitration");
-    _notify(name("arbenforce"), "Deal enforced by arbitration, seller got paid", d);
-    require_recipient(d.buyer);
-    _deals.erase(dealitr);
-    _clean_expired_deals(deal_id);
+  struct arbdecision {
+    uint64_t    deal_id;
+    name        resolution;   // arbrefund or arbenforce
+  };
+
+  // Resolve several disputes of one arbiter. The arbiter stats are
+  // updated once, and payments to the same account in the same token
+  // are added up into one transfer
+  ACTION arbresolve(name arbiter, vector<arbdecision> decisions)
+  {
+    require_auth(arbiter);
+    check(decisions.size() > 0, "decisions list cannot be empty");
+    payouts pay;
+    arbiter_closings closed;
+    for( const auto& dec : decisions ) {
+      auto dealitr = _deals.find(dec.deal_id);
+      _check(dealitr != _deals.end(), [&] { return "Cannot find deal ID: " + to_string(dec.deal_id); });
+      _check(dealitr->arbiter == arbiter, [&] {
+          return "Deal " + to_string(dec.deal_id) + " has a different arbiter";
+        });
+      _resolve_dispute(*dealitr, dec.resolution, pay, closed);
+    }
+    _send_payouts(pay);
+    _arbiter_deals_closed(arbiter, closed);
+    _sweep_expired();
   }
 
   
 
-  // erase up to X expired deals and one arbiter
+  // erase up to X expired deals. Anyone can call it to drain a backlog
+  // faster than the sweep in regular actions does
   ACTION wipeexpired(uint16_t count)
   {
-    bool done_something = false;
-    auto _now = time_point_sec(current_time_point());
-    auto dealidx = _deals.get_index<name("expires")>();
-    auto dealitr = dealidx.lower_bound(1); // 0 is for deals locked for arbitration
-    while( count-- > 0 && dealitr != dealidx.end() && dealitr->expires <= _now ) {
-      _deal_expired(*dealitr);
-      dealitr = dealidx.lower_bound(1);
-      done_something = true;
-    }
-
-    arbiters _arbiters(_self, _self.value);
-    auto arbidx = _arbiters.get_index<name("active")>();
-    auto arbitr = arbidx.lower_bound(0);
-    bool deleted = false;
-    while( !deleted && arbitr != arbidx.end() && arbitr->is_active == 0 ) {
-      name arbiter = arbitr->account;
-      auto adidx = _deals.get_index<name("arbiters")>();
-      auto aditr = adidx.lower_bound(arbiter.value);
-      if( aditr == adidx.end() || aditr->arbiter != arbiter ) {
-        // no open deals for this arbiter. deleting.
-        arbidx.erase(arbitr);
-        deleted = true;
-        // leave trace
-        action(
-               permission_level{_self, name("active")},
-               _self, 
-               name("arbdeleted"), 
-               std::make_tuple(arbiter)
-               ).send();        
-        done_something = true;
-      }
-      else {
-        arbitr++;
-      }
-    }      
-
-    check(done_something, "There are no expired transactions or inactive arbiters");
+    bool more;
+    check(_wipe_expired(count, more) > 0, "There are no expired transactions");
   }
 
   
@@ -455,53 +667,499 @@ CONTRACT escrowescrow : public eosio::contract {
     name        arbiter;
     uint32_t    days;
     string      delivery_memo;
+    binary_extension<uint64_t> template_id; // description is empty for template deals
   };
 
   ACTION notify(name deal_status, string message, uint64_t deal_id, name created_by,
                 string description, name tkcontract, asset& quantity,
-                name buyer, name seller, name arbiter, uint32_t days, string delivery_memo)
+                name buyer, name seller, name arbiter, uint32_t days, string delivery_memo,
+                binary_extension<uint64_t> template_id)
   {
     require_auth(_self);
   }
 
 
-  ACTION arbdeleted(name arbiter) {
-    require_auth(_self);
-  }
-  
-  
- private:
-  
-  struct [[eosio::table("deals")]] deal {
-    uint64_t       id;
-    name           created_by;
-    string         description;
-    extended_asset price;
-    name           buyer;
-    name           seller;
-    name           arbiter;
-    uint32_t       days;
-    time_point_sec funded;
-    time_point_sec expires;    
+  // compact notifications: fields that change after the deal is created
+  struct deal_event_abi {
+    uint64_t       deal_id;
+    name           deal_status;
+    uint32_t       seq;
     uint16_t       flags;
-    string         delivery_memo;
-    auto primary_key()const { return id; }
-    uint64_t get_expires()const { return expires.utc_seconds; }
-    uint64_t get_arbiter()const { return arbiter.value; }
+    time_point_sec funded;
+    time_point_sec expires;
+    uint32_t       days;
+    binary_extension<int64_t> remaining; // amount left in escrow, milestone deals only
   };
 
-  typedef eosio::multi_index<
-    name("deals"), deal,
-    indexed_by<name("expires"), const_mem_fun<deal, uint64_t, &deal::get_expires>>,
-    indexed_by<name("arbiters"), const_mem_fun<deal, uint64_t, &deal::get_arbiter>>> deals;
+  ACTION dealevent(uint64_t deal_id, name deal_status, uint32_t seq, uint16_t flags,
+                   time_point_sec funded, time_point_sec expires, uint32_t days,
+                   binary_extension<int64_t> remaining)
+  {
+    require_auth(_self);
+  }
 
-  deals _deals;
 
+  // Full notifications on every deal transition, or the full deal only
+  // at creation and compact dealevent records afterwards
+  ACTION notifymode(bool compact)
+  {
+    require_auth(_self);
+    props _props(_self, _self.value);
+    _set_prop(_props, name("compactntf"), compact ? 1 : 0);
+  }
 
-  struct [[eosio::table("arbiters")]] arbiter {
-    name           account;
-    string         contact_name;
-    string         email;
+
+  // Event classes (EVENTS_* bits) for which the account is added as a
+  // recipient of the action that changes its deal. Accounts without a
+  // subscription get all of them; subscribing to all removes the row.
+  ACTION subscribe(name account, uint8_t events)
+  {
+    require_auth(account);
+    check((events & ~EVENTS_ALL) == 0, "Unknown event class");
+    auto itr = _subscriptions.find(account.value);
+    if( events == EVENTS_ALL ) {
+      check(itr != _subscriptions.end(), "This account gets all events already");
+      _subscriptions.erase(itr);
+    }
+    else if( itr == _subscriptions.end() ) {
+      _subscriptions.emplace(account, [&]( auto& item ) {
+          item.account = account;
+          item.events = events;
+        });
+    }
+    else {
+      _subscriptions.modify(*itr, account, [&]( auto& item ) {
+          item.events = events;
+        });
+    }
+  }
+
+
+  ACTION arbdeleted(name arbiter) {
+    require_auth(_self);
+  }
+
+
+  // Number of expired deals that every action processes: min_budget when
+  // there is no backlog, doubling up to max_budget while it persists
+  ACTION setsweep(uint16_t min_budget, uint16_t max_budget)
+  {
+    require_auth(_self);
+    check(min_budget > 0, "min_budget must be positive");
+    check(max_budget >= min_budget, "max_budget cannot be less than min_budget");
+    sweepconf _sweep(_self, _self.value);
+    sweepstate s = _sweep.get_or_default(sweepstate{SWEEP_MIN_BUDGET, SWEEP_MAX_BUDGET, SWEEP_MIN_BUDGET});
+    s.min_budget = min_budget;
+    s.max_budget = max_budget;
+    s.budget = std::min(std::max(s.budget, min_budget), max_budget);
+    _sweep.set(s, _self);
+  }
+
+
+  // compact deal view returned by getdeals
+  struct deal_view {
+    uint64_t       deal_id;
+    extended_asset price;
+    name           buyer;
+    name           seller;
+    name           arbiter;
+    uint16_t       flags;
+    time_point_sec expires;
+  };
+
+  struct deal_page {
+    vector<deal_view> deals;
+    bool              more;          // if true, call again from the position below
+    time_point_sec    next_expires;
+    uint64_t          next_id;
+  };
+
+  // Deals where party has the given role (buyer or seller), nearest
+  // expiration first, filtered by (flags & flags_mask) == flags_value.
+  // The first page starts from zero expires and id; next pages start from
+  // next_expires and next_id of the previous page.
+  [[eosio::action, eosio::read_only]]
+  deal_page getdeals(name party, name role, uint16_t flags_mask, uint16_t flags_value,
+                     time_point_sec from_expires, uint64_t from_id, uint16_t limit)
+  {
+    _check(limit > 0 && limit <= QUERY_MAX_LIMIT, [] {
+        return "limit must be between 1 and " + to_string(QUERY_MAX_LIMIT);
+      });
+    if( role == name("buyer") ) {
+      return _query_deals(_deals.get_index<name("buyer")>(), party, flags_mask, flags_value,
+                          from_expires, from_id, limit);
+    }
+    check(role == name("seller"), "role must be either buyer or seller");
+    return _query_deals(_deals.get_index<name("seller")>(), party, flags_mask, flags_value,
+                        from_expires, from_id, limit);
+  }
+  
+
+  // arbiter directory entry returned by getarbiters
+  struct arbiter_summary {
+    name           account;
+    string         iso_country;
+    uint32_t       processed_deals;
+    uint32_t       open_deals;
+    uint32_t       open_disputes;
+    uint32_t       refunds;
+    uint32_t       enforcements;
+    uint64_t       avg_resolution_sec;
+  };
+
+  struct arbiter_page {
+    vector<arbiter_summary> arbiters;
+    bool                    more;    // if true, call again from the position below
+    uint32_t                next_processed;
+    name                    next_account;
+  };
+
+  // Active arbiters, most processed deals first, from one country or
+  // from all countries if iso_country is empty. The first page starts
+  // from from_processed = 4294967295 and an empty from_account; next
+  // pages start from next_processed and next_account of the previous page.
+  [[eosio::action, eosio::read_only]]
+  arbiter_page getarbiters(string iso_country, uint32_t from_processed, name from_account, uint16_t limit)
+  {
+    _check(limit > 0 && limit <= QUERY_MAX_LIMIT, [] {
+        return "limit must be between 1 and " + to_string(QUERY_MAX_LIMIT);
+      });
+    const uint16_t country = _country_code(iso_country);
+    if( country == 0 ) {
+      return _query_arbiters(_arbstats.get_index<name("ranking")>(), 0, from_processed, from_account, limit);
+    }
+    return _query_arbiters(_arbstats.get_index<name("country")>(), country, from_processed, from_account, limit);
+  }
+
+
+  // Operational counters, updated incrementally by the actions that
+  // change deals and written once per action
+  struct [[eosio::table("telemetry")]] telemetry {
+    uint32_t       open_deals;
+    uint32_t       buyer_accepted;   // open deals with each of the flags set
+    uint32_t       seller_accepted;
+    uint32_t       funded;
+    uint32_t       delivered;
+    uint32_t       arbitration;
+    time_point_sec oldest_expired;   // oldest expiry left over by the last sweep, 0 if none
+    uint16_t       last_swept;       // expired deals processed by the last sweep or wipeexpired
+    uint64_t       swept;
+    uint64_t       created;
+    uint64_t       closed;           // goods received
+    uint64_t       canceled;
+    uint64_t       expired;
+    uint64_t       arbitrated;       // resolved by arbiters
+    uint64_t       actions;          // actions that changed the counters
+  };
+
+  typedef eosio::singleton<name("telemetry"), telemetry> telemetryconf;
+
+  struct telemetry_view {
+    telemetry              counters;
+    vector<extended_asset> escrowed;   // for each of the requested tokens
+  };
+
+  // Telemetry counters and the amounts held in escrow for the given tokens
+  [[eosio::action, eosio::read_only]]
+  telemetry_view gettelemetry(vector<extended_symbol> tokens)
+  {
+    telemetry_view view { .counters = _stored_telemetry() };
+    for( const auto& t : tokens ) {
+      ledger _ledger(_self, t.get_contract().value);
+      auto itr = _ledger.find(t.get_symbol().code().raw());
+      view.escrowed.emplace_back(itr != _ledger.end() ? itr->escrowed : asset(0, t.get_symbol()),
+                                 t.get_contract());
+    }
+    return view;
+  }
+
+
+  struct reconciliation {
+    extended_asset escrowed;   // total price of funded deals, from the ledger
+    extended_asset balance;    // balance of the contract in the token contract
+    bool           solvent;    // balance covers the escrowed amount
+  };
+
+  // Solvency check of one token: two table lookups, whatever the number of deals
+  [[eosio::action, eosio::read_only]]
+  reconciliation reconcile(extended_symbol token)
+  {
+    const symbol sym = token.get_symbol();
+    const uint64_t code = sym.code().raw();
+    reconciliation r { .escrowed = extended_asset(0, token), .balance = extended_asset(0, token) };
+
+    ledger _ledger(_self, token.get_contract().value);
+    auto ledgeritr = _ledger.find(code);
+    if( ledgeritr != _ledger.end() ) {
+      r.escrowed.quantity = ledgeritr->escrowed;
+    }
+
+    accounts token_accounts(token.get_contract(), _self.value);
+    auto acitr = token_accounts.find(code);
+    if( acitr != token_accounts.end() ) {
+      check(acitr->balance.symbol == sym, "Invalid token precision");
+      r.balance.quantity = acitr->balance;
+    }
+    r.solvent = r.balance.quantity.amount >= r.escrowed.quantity.amount;
+    return r;
+  }
+
+
+  // What remains of a deal after it is closed: folded into the running
+  // hash of its checkpoint instead of being kept in RAM
+  struct closing_receipt {
+    uint64_t       deal_id;
+    name           buyer;
+    name           seller;
+    name           arbiter;
+    extended_asset price;
+    name           outcome;    // closed, canceled, expired, arbrefund or arbenforce
+    time_point_sec funded;     // zero if the deal was not funded
+    time_point_sec closed;
+  };
+
+  // The head of a checkpoint is
+  //   H(...H(H(start || D(r1)) || D(r2))... || D(rn))
+  // where H is SHA-256, D(r) is the SHA-256 of the packed receipt and
+  // start is the head of the previous checkpoint. A checkpoint holds up
+  // to CHECKPOINT_MAX_RECEIPTS receipts of one period, so a receipt is
+  // verified with the digests of the other receipts of its checkpoint,
+  // those before it and those after it, from the stored start.
+  [[eosio::action, eosio::read_only]]
+  bool verifyrcpt(uint64_t checkpoint_id, vector<checksum256> before, closing_receipt receipt,
+                  vector<checksum256> after)
+  {
+    const checkpoint& cp = _checkpoints.get(checkpoint_id, "Cannot find the checkpoint");
+    if( before.size() + after.size() + 1 != cp.receipts ) {
+      return false;
+    }
+    checksum256 h = cp.start;
+    for( const auto& digest : before ) {
+      h = _chain_hash(h, digest);
+    }
+    h = _chain_hash(h, _receipt_digest(receipt));
+    for( const auto& digest : after ) {
+      h = _chain_hash(h, digest);
+    }
+    return h == cp.head;
+  }
+
+
+  static checksum256 _receipt_digest(const closing_receipt& r)
+  {
+    const auto packed = pack(r);
+    return sha256(packed.data(), packed.size());
+  }
+
+
+  static checksum256 _chain_hash(const checksum256& head, const checksum256& digest)
+  {
+    char buf[64];
+    const auto h = head.extract_as_byte_array();
+    const auto d = digest.extract_as_byte_array();
+    memcpy(buf, h.data(), 32);
+    memcpy(buf + 32, d.data(), 32);
+    return sha256(buf, sizeof(buf));
+  }
+
+
+  // Move up to count deals from the old single-row layout into the
+  // dealstate and dealtexts tables
+  ACTION migrate(uint32_t count)
+  {
+    require_auth(_self);
+    olddeals _olddeals(_self, _self.value);
+    auto itr = _olddeals.begin();
+    check(itr != _olddeals.end(), "There are no deals to migrate");
+    telemetry& tm = _telemetry();
+    while( count-- > 0 && itr != _olddeals.end() ) {
+      const olddeal& o = *itr;
+      _deals.emplace(_self, [&]( auto& d ) {
+          d.id = o.id;
+          d.created_by = o.created_by;
+          d.price = o.price;
+          d.buyer = o.buyer;
+          d.seller = o.seller;
+          d.arbiter = o.arbiter;
+          d.days = o.days;
+          d.funded = o.funded;
+          d.term_start = o.funded;
+          d.expires = o.expires;
+          d.flags = o.flags;
+          d.evseq = 0;
+          d.milestone = 0;
+          d.milestones = 0;
+        });
+      _texts.emplace(_self, [&]( auto& t ) {
+          t.id = o.id;
+          t.description = o.description;
+          t.delivery_memo = o.delivery_memo;
+          t.template_id = 0;
+        });
+      _arbiter_deal_opened(o.arbiter, o.flags & DEAL_ARBITRATION_FLAG);
+      tm.open_deals++;
+      _count_flags(0, o.flags);
+      if( o.flags & DEAL_FUNDED_FLAG ) {
+        _ledger_update(o.price, true);
+      }
+      itr = _olddeals.erase(itr);
+    }
+  }
+
+
+  // Create the arbstats rows of up to count arbiters registered before
+  // the stats table existed, so that getarbiters lists them. Starts at
+  // account from and returns the account to continue from, or an empty
+  // name when every arbiter has its row.
+  [[eosio::action]]
+  name fillarbstats(name from, uint32_t count)
+  {
+    require_auth(_self);
+    check(count > 0, "count must be positive");
+    arbiters _arbiters(_self, _self.value);
+    auto itr = _arbiters.lower_bound(from.value);
+    while( itr != _arbiters.end() ) {
+      if( count-- == 0 ) {
+        return itr->account;
+      }
+      _arbiter_stat(itr->account);
+      itr++;
+    }
+    return name();
+  }
+  
+  
+ private:
+  
+  // Fixed-size deal state, rewritten on every transition
+  struct [[eosio::table("dealstate")]] deal {
+    uint64_t       id;
+    name           created_by;
+    extended_asset price;
+    name           buyer;
+    name           seller;
+    name           arbiter;
+    uint32_t       days;
+    time_point_sec funded;
+    time_point_sec term_start; // start of the current delivery term
+    time_point_sec expires;    
+    time_point_sec disputed;   // when the deal went to arbitration
+    uint16_t       flags;
+    uint32_t       evseq;      // sequence number of the last compact event
+    uint8_t        milestone;  // current milestone, counted from 0
+    uint8_t        milestones; // 0 for a deal paid at once
+    auto primary_key()const { return id; }
+    uint64_t get_expires()const { return expires.utc_seconds; }
+    uint128_t get_buyer_expires()const { return _party_key(buyer, expires); }
+    uint128_t get_seller_expires()const { return _party_key(seller, expires); }
+  };
+
+  // party in the upper 64 bits, expiration time in the lower
+  static uint128_t _party_key(name party, time_point_sec expires)
+  {
+    return ((uint128_t)party.value << 64) | expires.utc_seconds;
+  }
+
+  typedef eosio::multi_index<
+    name("dealstate"), deal,
+    indexed_by<name("expires"), const_mem_fun<deal, uint64_t, &deal::get_expires>>,
+    indexed_by<name("buyer"), const_mem_fun<deal, uint128_t, &deal::get_buyer_expires>>,
+    indexed_by<name("seller"), const_mem_fun<deal, uint128_t, &deal::get_seller_expires>>> deals;
+
+  deals _deals;
+
+  
+  // Descriptive text of a deal, written at creation and delivery only
+  struct [[eosio::table("dealtexts")]] dealtext {
+    uint64_t       id;
+    string         description;    // empty if the deal refers to a template
+    string         delivery_memo;
+    uint64_t       template_id;    // 0 if the deal has its own description
+    vector<milestone> milestones;  // empty for a deal paid at once
+    auto primary_key()const { return id; }
+  };
+
+  typedef eosio::multi_index<name("dealtexts"), dealtext> dealtexts;
+
+  dealtexts _texts;
+
+
+  // Terms shared by repeat deals, freed when the last deal using them closes
+  struct [[eosio::table("templates")]] dealtemplate {
+    uint64_t       id;             // from the hash of the terms
+    name           owner;
+    string         description;
+    name           tkcontract;
+    symbol         sym;
+    uint32_t       days;           // default delivery term
+    name           arbiter;
+    uint32_t       refs;           // open deals using the template
+    auto primary_key()const { return id; }
+  };
+
+  typedef eosio::multi_index<name("templates"), dealtemplate> dealtemplates;
+
+  dealtemplates _templates;
+
+
+  // standing acceptance policy of a seller, see setpolicy
+  struct [[eosio::table("policies")]] sellerpolicy {
+    name                seller;
+    vector<policytoken> tokens;
+    vector<name>        arbiters;
+    uint32_t            max_days;
+    auto primary_key()const { return seller.value; }
+  };
+
+  typedef eosio::multi_index<name("policies"), sellerpolicy> sellerpolicies;
+
+  sellerpolicies _policies;
+
+
+  // event classes that add the account as a recipient, see subscribe
+  struct [[eosio::table("subscription")]] subscription {
+    name           account;
+    uint8_t        events;
+    auto primary_key()const { return account.value; }
+  };
+
+  typedef eosio::multi_index<name("subscription"), subscription> subscriptions;
+
+  subscriptions _subscriptions;
+  std::map<uint64_t, uint8_t> _subscribed;  // events by account, read once per action
+  int8_t _has_subscriptions = -1;           // -1 until read
+
+  
+  // Deals in the layout used before the hot/cold split, read by migrate
+  // and by arbiter deletion only
+  struct [[eosio::table("deals")]] olddeal {
+    uint64_t       id;
+    name           created_by;
+    string         description;
+    extended_asset price;
+    name           buyer;
+    name           seller;
+    name           arbiter;
+    uint32_t       days;
+    time_point_sec funded;
+    time_point_sec expires;    
+    uint16_t       flags;
+    string         delivery_memo;
+    auto primary_key()const { return id; }
+    uint64_t get_expires()const { return expires.utc_seconds; }
+    uint64_t get_arbiter()const { return arbiter.value; }
+  };
+
+  typedef eosio::multi_index<
+    name("deals"), olddeal,
+    indexed_by<name("expires"), const_mem_fun<olddeal, uint64_t, &olddeal::get_expires>>,
+    indexed_by<name("arbiters"), const_mem_fun<olddeal, uint64_t, &olddeal::get_arbiter>>> olddeals;
+
+
+  struct [[eosio::table("arbiters")]] arbiter {
+    name           account;
+    string         contact_name;
+    string         email;
     string         description;
     string         website;
     string         phone;
@@ -513,90 +1171,1371 @@ CONTRACT escrowescrow : public eosio::contract {
     uint64_t get_is_active()const { return is_active; }
   };
 
-  typedef eosio::multi_index<
-    name("arbiters"), arbiter,
-    indexed_by<name("active"), const_mem_fun<arbiter, uint64_t, &arbiter::get_is_active>>> arbiters;
+  typedef eosio::multi_index<
+    name("arbiters"), arbiter,
+    indexed_by<name("active"), const_mem_fun<arbiter, uint64_t, &arbiter::get_is_active>>> arbiters;
+
+
+  // Fixed-size arbiter status and statistics, updated on the deal hot
+  // paths instead of the profile. A retired arbiter is deleted as soon as
+  // open_deals drops to zero. Supersedes processed_deals in the profile;
+  // is_active is also written to the profile when the arbiter retires.
+  struct [[eosio::table("arbstats")]] arbstat {
+    name           account;
+    uint8_t        is_active;
+    uint16_t       country;        // ISO country code of the profile, 0 if none
+    uint32_t       open_deals = 0;
+    uint32_t       open_disputes = 0;
+    uint32_t       processed_deals = 0;
+    uint32_t       refunds = 0;
+    uint32_t       enforcements = 0;
+    uint64_t       resolution_sec = 0; // total time from opening to resolution of disputes
+    auto primary_key()const { return account.value; }
+    uint128_t get_country_rank()const { return _directory_key(is_active, country, processed_deals, account); }
+    uint128_t get_rank()const { return _directory_key(is_active, 0, processed_deals, account); }
+  };
+
+  // active flag and country in the upper 32 bits, then processed deals in
+  // descending order and the account, so that the busiest arbiters of a
+  // country come first
+  static uint128_t _directory_key(bool active, uint16_t country, uint32_t processed, name account)
+  {
+    uint64_t high = ((uint64_t)(active ? 1 : 0) << 48) | ((uint64_t)country << 32) | (0xFFFFFFFF - processed);
+    return ((uint128_t)high << 64) | account.value;
+  }
+
+  typedef eosio::multi_index<
+    name("arbstats"), arbstat,
+    indexed_by<name("country"), const_mem_fun<arbstat, uint128_t, &arbstat::get_country_rank>>,
+    indexed_by<name("ranking"), const_mem_fun<arbstat, uint128_t, &arbstat::get_rank>>
+    > arbstats;
+
+  arbstats _arbstats;
+
+  // arbiter stats changes from the deals closed in an action
+  struct arbiter_closings {
+    uint32_t       deals = 0;
+    uint32_t       disputes = 0;
+    uint32_t       refunds = 0;
+    uint32_t       enforcements = 0;
+    uint64_t       resolution_sec = 0;
+  };
+
+  // token payouts of an action, added up per recipient and token
+  struct payout {
+    extended_asset total;
+    string_view    reason;         // of all its deals, or a neutral batch memo
+    string         deal_ids;
+    uint32_t       deals = 0;
+  };
+
+  typedef std::map<std::tuple<uint64_t, uint64_t, uint64_t>, payout> payouts;
+
+
+  // contract-wide settings and counters
+  struct [[eosio::table("props")]] prop {
+    name           key;
+    uint64_t       val;
+    auto primary_key()const { return key.value; }
+  };
+
+  typedef eosio::multi_index<name("props"), prop> props;
+
+
+  // expiry sweep configuration and its current budget
+  struct [[eosio::table("sweep")]] sweepstate {
+    uint16_t   min_budget;
+    uint16_t   max_budget;
+    uint16_t   budget;
+  };
+
+  typedef eosio::singleton<name("sweep"), sweepstate> sweepconf;
+
+
+  // tokens accepted in deals, scoped by token contract
+  struct [[eosio::table("tokens")]] token {
+    symbol         sym;
+    int64_t        min_amount;  // smallest deal price, 0 for no limit
+    int64_t        max_amount;  // largest deal price, 0 for no limit
+    auto primary_key()const { return sym.code().raw(); }
+  };
+
+  typedef eosio::multi_index<name("tokens"), token> tokens;
+
+
+  // tokens held in escrow for funded deals, scoped by token contract
+  struct [[eosio::table("ledger")]] ledgerentry {
+    asset          escrowed;
+    auto primary_key()const { return escrowed.symbol.code().raw(); }
+  };
+
+  typedef eosio::multi_index<name("ledger"), ledgerentry> ledger;
+
+
+  // running hash of the receipts of deals closed in one period, up to
+  // CHECKPOINT_MAX_RECEIPTS of them
+  struct [[eosio::table("checkpoints")]] checkpoint {
+    uint64_t       id;         // sequence number from 0
+    uint64_t       period;     // closing time / CHECKPOINT_PERIOD_SEC
+    checksum256    start;      // head of the previous checkpoint
+    checksum256    head;
+    uint32_t       receipts;
+    auto primary_key()const { return id; }
+  };
+
+  typedef eosio::multi_index<name("checkpoints"), checkpoint> checkpoints;
+
+  checkpoints _checkpoints;
+
+  
+  uint64_t _get_prop(props& _props, name key, uint64_t dflt)
+  {
+    auto itr = _props.find(key.value);
+    return (itr == _props.end()) ? dflt : itr->val;
+  }
+
+
+  void _set_prop(props& _props, name key, uint64_t val)
+  {
+    auto itr = _props.find(key.value);
+    if( itr == _props.end() ) {
+      _props.emplace(_self, [&]( auto& item ) {
+          item.key = key;
+          item.val = val;
+        });
+    }
+    else {
+      _props.modify(*itr, _self, [&]( auto& item ) {
+          item.val = val;
+        });
+    }
+  }
+
+  // accounts, token balances and arbiters already validated in this action
+  struct deal_checks {
+    std::set<uint64_t> accounts;
+    std::set<std::tuple<uint64_t, uint64_t, uint64_t>> balances;
+    std::set<uint64_t> arbiters;
+    std::map<std::pair<uint64_t, uint64_t>, token> tokens;
+    std::map<uint64_t, const sellerpolicy*> policies;   // nullptr if the seller has none
+  };
+
+
+  // check() with an error message that is formatted only if the check fails
+  template<typename Message>
+  static void _check(bool pred, Message&& message)
+  {
+    if( !pred ) {
+      check(false, message());
+    }
+  }
+
+
+  void _check_account(deal_checks& checks, name account, const char* error)
+  {
+    if( checks.accounts.insert(account.value).second ) {
+      check(is_account(account), error);
+    }
+  }
+  
+
+  // template deals take the description from the template
+  void _validate_deal(deal_checks& checks, const dealspec& spec, bool from_template = false)
+  {
+    check(from_template || spec.description.length() > 0, "description cannot be empty");
+    const uint8_t token_mode = _get_token_mode();
+    if( token_mode == TOKENS_OPEN ) {
+      _check_account(checks, spec.tkcontract, "tkcontract account does not exist");
+    }
+    check(spec.quantity.is_valid(), "invalid quantity" );
+    check(spec.quantity.amount > 0, "must specify a positive quantity" );
+    _check_account(checks, spec.buyer, "buyer account does not exist");
+    _check_account(checks, spec.seller, "seller account does not exist");
+    _check_account(checks, spec.arbiter, "arbiter account does not exist");
+    check(spec.buyer != spec.seller && spec.buyer != spec.arbiter && spec.seller != spec.arbiter,
+                 "Buyer, seller and arbiter must be different accounts");
+    
+    check(spec.days > 0, "delivery term should be a positive number of days");
+
+    // Registered tokens are validated locally, with their deal size limits
+    const auto token_name = spec.quantity.symbol.code().raw();
+    if( token_mode != TOKENS_OPEN ) {
+      auto key = std::make_pair(spec.tkcontract.value, token_name);
+      auto tkitr = checks.tokens.find(key);
+      if( tkitr == checks.tokens.end() ) {
+        tkitr = checks.tokens.emplace(key, _get_token(spec.tkcontract, spec.quantity.symbol)).first;
+      }
+      const token& t = tkitr->second;
+      check(t.sym == spec.quantity.symbol, "Invalid token precision");
+      check(spec.quantity.amount >= t.min_amount, "Deal amount is below the minimum for this token");
+      check(t.max_amount == 0 || spec.quantity.amount <= t.max_amount,
+            "Deal amount is above the maximum for this token");
+    }
+
+    // Unless in strict mode, the buyer should have a non-zero balance of payment token
+    if( token_mode != TOKENS_STRICT &&
+        checks.balances.emplace(spec.tkcontract.value, spec.buyer.value, token_name).second ) {
+      accounts token_accounts(spec.tkcontract, spec.buyer.value);
+      auto token_accounts_itr = token_accounts.find(token_name);
+      check(token_accounts_itr != token_accounts.end() && token_accounts_itr->balance.amount > 0,
+                   "Invalid currency or the buyer has no funds");
+    }
+
+    // Check that arbiter is active
+    if( checks.arbiters.insert(spec.arbiter.value).second ) {
+      auto statitr = _arbstats.find(spec.arbiter.value);
+      if( statitr != _arbstats.end() ) {
+        check(statitr->is_active, "This arbiter marked as inactive");
+      }
+      else {
+        arbiters _arbiters(_self, _self.value);
+        auto arbitr = _arbiters.find(spec.arbiter.value);
+        check(arbitr != _arbiters.end(), "Cannot find the arbiter");
+        check(arbitr->is_active, "This arbiter marked as inactive");
+      }
+    }
+  }
+
+
+  // Returns the first of count consecutive deal IDs. Sequential IDs come
+  // from a persistent counter starting above the 32-bit range, so they
+  // never clash with legacy IDs. In legacy mode the range starts at the
+  // first 32 bits of the transaction ID.
+  uint64_t _reserve_deal_ids(uint32_t count, bool& legacy)
+  {
+    props _props(_self, _self.value);
+    legacy = _get_prop(_props, name("legacyids"), 0);
+    if( legacy ) {
+      return _txid_prefix();
+    }
+    uint64_t id = _get_prop(_props, name("nextdealid"), FIRST_SEQ_DEAL_ID);
+    _set_prop(_props, name("nextdealid"), id + count);
+    return id;
+  }
+
+
+  // first free legacy 32-bit ID at or after the given one
+  uint64_t _free_legacy_id(uint64_t id)
+  {
+    olddeals _olddeals(_self, _self.value);
+    id &= 0xFFFFFFFF;
+    while( _deals.find(id) != _deals.end() || _olddeals.find(id) != _olddeals.end() ) {
+      id = (id + 1) & 0xFFFFFFFF;
+    }
+    return id;
+  }
+
+
+  // first 32 bits from transaction ID
+  uint64_t _txid_prefix()
+  {
+    uint64_t id = 0;
+    auto size = transaction_size();
+    char buf[size];
+    uint32_t read = read_transaction( buf, size );
+    check( size == read, "read_transaction failed");
+    checksum256 h = sha256(buf, size);
+    auto hbytes = h.extract_as_byte_array();
+    for(int i=0; i<4; i++) {
+      id <<=8;
+      id |= hbytes[i];
+    }
+    return id;
+  }
+
+
+  // first 64 bits of the SHA-256 of the packed template terms
+  static uint64_t _template_hash(const string& description, name tkcontract, symbol sym,
+                                 uint32_t days, name arbiter)
+  {
+    const auto packed = pack(std::forward_as_tuple(description, tkcontract, sym, days, arbiter));
+    auto hbytes = sha256(packed.data(), packed.size()).extract_as_byte_array();
+    uint64_t id = 0;
+    for(int i=0; i<8; i++) {
+      id <<=8;
+      id |= hbytes[i];
+    }
+    return id;
+  }
+
+
+  // true if the seller policy accepts a deal created by someone else
+  bool _policy_accepts(deal_checks& checks, name creator, const dealspec& spec)
+  {
+    if( creator == spec.seller ) {
+      return false;
+    }
+    auto [pitr, added] = checks.policies.emplace(spec.seller.value, nullptr);
+    if( added ) {
+      auto itr = _policies.find(spec.seller.value);
+      if( itr != _policies.end() ) {
+        pitr->second = &*itr;
+      }
+    }
+    const sellerpolicy* p = pitr->second;
+    if( p == nullptr || (p->max_days > 0 && spec.days > p->max_days) ) {
+      return false;
+    }
+    if( !p->arbiters.empty() &&
+        std::find(p->arbiters.begin(), p->arbiters.end(), spec.arbiter) == p->arbiters.end() ) {
+      return false;
+    }
+    for( const auto& t : p->tokens ) {
+      if( t.contract == spec.tkcontract && t.sym == spec.quantity.symbol ) {
+        return spec.quantity.amount >= t.min_amount &&
+          (t.max_amount == 0 || spec.quantity.amount <= t.max_amount);
+      }
+    }
+    return false;
+  }
+
+
+  // RAM is paid by the creator, or by payer if given. A milestone deal
+  // starts with the term of its first milestone.
+  void _create_deal(deal_checks& checks, name creator, uint64_t id, const dealspec& spec,
+                    uint64_t template_id = 0, name payer = name(),
+                    const vector<milestone>* milestones = nullptr)
+  {
+    const bool policy_accepted = _policy_accepts(checks, creator, spec);
+    if( payer == name() ) {
+      payer = creator;
+    }
+    telemetry& tm = _telemetry();
+    auto idx = _deals.emplace(payer, [&]( auto& d ) {
+        d.id = id;
+        d.created_by = creator;
+        d.price.contract = spec.tkcontract;
+        d.price.quantity = spec.quantity;
+        d.buyer = spec.buyer;
+        d.seller = spec.seller;
+        d.arbiter = spec.arbiter;
+        d.days = milestones ? milestones->front().days : spec.days;
+        d.expires = time_point_sec(current_time_point()) + NEW_DEAL_EXPIRES;
+        d.term_start = time_point_sec();
+        d.flags = 0;
+        d.evseq = 0;
+        d.milestone = 0;
+        d.milestones = milestones ? milestones->size() : 0;
+        if( creator == spec.buyer ) {
+          d.flags |= BUYER_ACCEPTED_FLAG;
+        } else if ( creator == spec.seller ) {
+          d.flags |= SELLER_ACCEPTED_FLAG;
+        }
+        if( policy_accepted ) {
+          d.flags |= SELLER_ACCEPTED_FLAG;
+          if( (d.flags & BOTH_ACCEPTED_FLAG) == BOTH_ACCEPTED_FLAG ) {
+            d.expires = time_point_sec(current_time_point()) + ACCEPTED_DEAL_EXPIRES;
+            d.evseq = 1;
+          }
+        }
+      });
+    _texts.emplace(payer, [&]( auto& t ) {
+        t.id = id;
+        t.description = spec.description;
+        t.template_id = template_id;
+        if( milestones ) {
+          t.milestones = *milestones;
+        }
+      });
+    _arbiter_deal_opened(spec.arbiter);
+    tm.open_deals++;
+    tm.created++;
+    _count_flags(0, idx->flags);
+    _send_full_notification(name("new"), "New deal created", *idx);
+    if( policy_accepted && (idx->flags & BOTH_ACCEPTED_FLAG) == BOTH_ACCEPTED_FLAG ) {
+      _notify(name("accepted"), "Deal is accepted by the seller policy", *idx);
+    }
+    
+    _require_recipient(spec.buyer, EVENTS_NEW);
+    _require_recipient(spec.seller, EVENTS_NEW);
+    _require_recipient(spec.arbiter, EVENTS_NEW);
+  }
+
+      
+  // mark one deal as funded by the buyer's transfer; the caller checks the total amount
+  const deal& _fund_deal(name from, uint64_t deal_id, const extended_asset& payment)
+  {
+    auto dealitr = _deals.find(deal_id);
+    _check(dealitr != _deals.end(), [&] { return "Cannot find deal ID: " + to_string(deal_id); });
+    const deal& d = *dealitr;
+
+    _check_transition<T_FUND>(d, from);
+
+    _check(payment.get_extended_symbol() == d.price.get_extended_symbol(), [&] {
+        return "Invalid amount or currency. Expected " +
+          d.price.quantity.to_string() + " via " + d.price.contract.to_string();
+      });
+    _apply_transition<T_FUND>(d, _self);
+    _notify(name("funded"), "Deal is funded", d);
+    _require_recipient(d.seller, EVENTS_FUNDED);
+    return d;
+  }
+
+
+  // next field of a transfer memo, up to a colon or the end
+  static string_view _memo_field(string_view& params)
+  {
+    check(!params.empty(), "Missing deal parameters in memo");
+    const size_t pos = params.find(':');
+    const string_view field = params.substr(0, pos);
+    params.remove_prefix(pos == string_view::npos ? params.size() : pos + 1);
+    return field;
+  }
+
+
+  static uint64_t _memo_number(string_view field, const char* error)
+  {
+    check(!field.empty(), error);
+    uint64_t val = 0;
+    for( char c : field ) {
+      check('0' <= c && c <= '9', error);
+      check(val <= (UINT64_MAX - (c - '0')) / 10, error);
+      val = val * 10 + (c - '0');
+    }
+    return val;
+  }
+
+
+  // Create a deal from the parameters in a transfer memo and fund it with
+  // the transfer. The memo is either
+  //   deal:SELLER:ARBITER:DAYS:DESCRIPTION
+  // or, for a deal from a template (DAYS of 0 takes the template term),
+  //   tpl:TEMPLATE_ID:SELLER:DAYS
+  void _create_funded_deal(name buyer, const extended_asset& payment, string_view params)
+  {
+    // the contract pays for the RAM of the deal, so the payment must be in
+    // a registered token with a minimum deal price
+    check(_get_token_mode() != TOKENS_OPEN, "Deals can only be created by transfer of a registered token");
+    dealspec spec { .tkcontract=payment.contract, .quantity=payment.quantity, .buyer=buyer };
+    uint64_t template_id = 0;
+    if( _memo_field(params) == "deal" ) {
+      spec.seller = name(_memo_field(params));
+      spec.arbiter = name(_memo_field(params));
+      spec.days = _memo_number(_memo_field(params), "Invalid delivery term in memo");
+      spec.description = params;
+    }
+    else {
+      template_id = _memo_number(_memo_field(params), "Invalid template ID in memo");
+      spec.seller = name(_memo_field(params));
+      spec.days = _memo_number(_memo_field(params), "Invalid delivery term in memo");
+      check(params.empty(), "Unexpected data at the end of memo");
+      const dealtemplate& tpl = _templates.get(template_id, "Cannot find the template");
+      check(payment.contract == tpl.tkcontract && payment.quantity.symbol == tpl.sym,
+            "Payment token does not match the template");
+      spec.arbiter = tpl.arbiter;
+      if( spec.days == 0 ) {
+        spec.days = tpl.days;
+      }
+      _templates.modify(tpl, same_payer, [&]( auto& item ) {
+          item.refs++;
+        });
+    }
+
+    deal_checks checks;
+    // the buyer has just paid, so the balance is not checked
+    checks.balances.emplace(spec.tkcontract.value, buyer.value, spec.quantity.symbol.code().raw());
+    _validate_deal(checks, spec, template_id != 0);
+    const token& t = checks.tokens.at(std::make_pair(spec.tkcontract.value, spec.quantity.symbol.code().raw()));
+    check(t.min_amount > 0, "Deals can only be created by transfer of a token with a minimum deal amount");
+
+    bool legacy;
+    uint64_t id = _reserve_deal_ids(1, legacy);
+    if( legacy ) {
+      id = _free_legacy_id(id);
+    }
+    // a notification handler cannot bill RAM to the buyer
+    _create_deal(checks, buyer, id, spec, template_id, _self);
+    // until the seller accepts it, the deal keeps the acceptance
+    // deadline and is refunded if that passes
+    const deal& d = _deals.get(id);
+    _apply_transition<T_PREPAY>(d, _self);
+    _notify(name("funded"), "Deal is funded", d);
+    _require_recipient(d.seller, EVENTS_FUNDED);
+  }
+
+      
+  // process expired deals within the adaptive budget. The config is read
+  // only when the head of the expires index has actually expired
+  void _sweep_expired()
+  {
+    auto dealidx = _deals.get_index<name("expires")>();
+    auto dealitr = dealidx.lower_bound(1); // 0 is for deals locked for arbitration
+    if( dealitr == dealidx.end() || dealitr->expires > time_point_sec(current_time_point()) ) {
+      if( _stored_telemetry().oldest_expired.utc_seconds != 0 ) {
+        _telemetry().oldest_expired = time_point_sec();
+      }
+      return;
+    }
+
+    sweepconf _sweep(_self, _self.value);
+    sweepstate s = _sweep.get_or_default(sweepstate{SWEEP_MIN_BUDGET, SWEEP_MAX_BUDGET, SWEEP_MIN_BUDGET});
+    bool more;
+    _wipe_expired(s.budget, more);
+    uint16_t budget = more ? std::min<uint32_t>(s.budget * 2, s.max_budget) : s.min_budget;
+    if( budget != s.budget ) {
+      s.budget = budget;
+      _sweep.set(s, _self);
+    }
+  }
+
+
+  // process up to count expired deals in one pass over the expires index;
+  // more is set if expired deals are left over
+  uint16_t _wipe_expired(uint16_t count, bool& more)
+  {
+    auto _now = time_point_sec(current_time_point());
+    auto dealidx = _deals.get_index<name("expires")>();
+    auto dealitr = dealidx.lower_bound(1);
+    uint16_t done = 0;
+    while( dealitr != dealidx.end() && dealitr->expires <= _now && done < count ) {
+      auto next = std::next(dealitr);
+      _deal_expired(*dealitr);
+      dealitr = next;
+      done++;
+    }
+    more = (dealitr != dealidx.end() && dealitr->expires <= _now);
+    telemetry& tm = _telemetry();
+    tm.oldest_expired = more ? dealitr->expires : time_point_sec();
+    tm.last_swept = done;
+    tm.swept += done;
+    return done;
+  }
+
+
+  void _deal_expired(const deal& d)
+  {
+    if( d.flags & DEAL_DELIVERED_FLAG ) {
+      _apply_transition<T_DISPUTE>(d, _self);
+      _arbstats.modify(_arbiter_stat(d.arbiter), same_payer, [&]( auto& item ) {
+          item.open_disputes++;
+        });
+      _notify(name("arbitration"),
+              "Goods Received was not issued on time. The deal is open for arbitration", d);
+      _require_recipient(d.seller, EVENTS_ARBITRATION);
+      _require_recipient(d.buyer, EVENTS_ARBITRATION);
+      _require_recipient(d.arbiter, EVENTS_ARBITRATION);
+    }
+    else {
+      string msg;
+      msg.reserve(32);
+      msg += "Deal ";
+      msg += to_string(d.id);
+      const size_t prefix = msg.size();
+      msg += " expired";
+      if( d.flags & DEAL_FUNDED_FLAG ) {
+        _send_payment(d.buyer, d.price, msg); // refund the buyer
+        if( !_compact_notify() ) {
+          msg.replace(prefix, string::npos, " refunded");
+          _notify(name("refund"), msg, d);
+          msg.replace(prefix, string::npos, " expired");
+        }
+      }
+      else {
+        _require_recipient(d.buyer, EVENTS_EXPIRED);  // in case of a payback, the buyer is already notified
+      }
+      _require_recipient(d.seller, EVENTS_EXPIRED);
+      _notify_closing(name("expired"), msg, d);
+      _erase_deal(d);
+    }
+  }
+
+
+  
+  template<typename Index>
+  deal_page _query_deals(const Index& idx, name party, uint16_t flags_mask, uint16_t flags_value,
+                         time_point_sec from_expires, uint64_t from_id, uint16_t limit)
+  {
+    deal_page page { .more=false };
+
+    // Deals that expire in the same second are in ID order. Resume right
+    // at the first deal from from_id on if it is still at the position.
+    // If no deal has an ID from from_id on, the rest of that second was
+    // listed already.
+    auto itr = idx.end();
+    auto cursor = _deals.lower_bound(from_id);
+    if( cursor != _deals.end() && Index::extract_secondary_key(*cursor) == _party_key(party, from_expires) ) {
+      itr = idx.iterator_to(*cursor);
+    }
+    else if( cursor == _deals.end() ) {
+      itr = idx.lower_bound(_party_key(party, from_expires) + 1);
+    }
+    else {
+      itr = idx.lower_bound(_party_key(party, from_expires));
+    }
+
+    uint16_t scanned = 0;
+    while( itr != idx.end() && (uint64_t)(Index::extract_secondary_key(*itr) >> 64) == party.value ) {
+      if( itr->expires == from_expires && itr->id < from_id ) {
+        // listed on a previous page
+        if( scanned == QUERY_MAX_SCAN ) {
+          // no deal of that second has an ID from from_id up to the cursor
+          page.more = true;
+          page.next_expires = from_expires;
+          page.next_id = cursor->id + 1;
+          break;
+        }
+        scanned++;
+        itr++;
+        continue;
+      }
+      if( page.deals.size() == limit || scanned == QUERY_MAX_SCAN ) {
+        page.more = true;
+        page.next_expires = itr->expires;
+        page.next_id = itr->id;
+        break;
+      }
+      if( (itr->flags & flags_mask) == flags_value ) {
+        page.deals.push_back(deal_view {
+            .deal_id=itr->id, .price=itr->price, .buyer=itr->buyer, .seller=itr->seller,
+            .arbiter=itr->arbiter, .flags=itr->flags, .expires=itr->expires });
+      }
+      scanned++;
+      itr++;
+    }
+    return page;
+  }
+
+
+  void _erase_deal(const deal& d)
+  {
+    const name arbiter = d.arbiter;
+    arbiter_closings closed;
+    _erase_deal(d, name(), closed);
+    _arbiter_deals_closed(arbiter, closed);
+  }
+
+
+  // erase a deal and add it to the arbiter stats changes. resolution is
+  // arbrefund or arbenforce when the arbiter closes the deal
+  void _erase_deal(const deal& d, name resolution, arbiter_closings& closed)
+  {
+    telemetry& tm = _telemetry();
+    tm.open_deals--;
+    _count_flags(d.flags, 0);
+    closed.deals++;
+    _count_resolution(d, resolution, closed);
+    const dealtext& t = _texts.get(d.id);
+    if( t.template_id != 0 ) {
+      _template_released(t.template_id);
+    }
+    _texts.erase(t);
+    _deals.erase(d);
+  }
+
 
-      
-  void _clean_expired_deals(uint64_t senderid)
+  // add the end of a dispute, and the arbiter decision if any, to the
+  // arbiter stats changes
+  void _count_resolution(const deal& d, name resolution, arbiter_closings& closed)
   {
-    auto _now = time_point_sec(current_time_point());
-    auto dealidx = _deals.get_index<name("expires")>();
-    auto dealitr = dealidx.lower_bound(1); // 0 is for deals locked for arbitration
-    if( dealitr != dealidx.end() && dealitr->expires <= _now ) {
-      // Send a deferred transaction that wipes up to WIPE_EXP_DEALS_TAX expired records
-      transaction tx;
-      tx.actions.emplace_back(
-                              permission_level{_self, name("active")},
-                              _self,
-                              name("wipeexpired"),
-                              std::make_tuple(WIPE_EXP_DEALS_TAX)
-                              );
-      tx.delay_sec = WIPE_EXP_TX_DELAY;
-      tx.send(senderid, _self);
+    if( d.flags & DEAL_ARBITRATION_FLAG ) {
+      closed.disputes++;
+    }
+    if( resolution == name("arbrefund") ) {
+      closed.refunds++;
+    }
+    else if( resolution == name("arbenforce") ) {
+      closed.enforcements++;
+    }
+    if( resolution != name() && d.disputed.utc_seconds > 0 ) {
+      closed.resolution_sec += time_point_sec(current_time_point()).utc_seconds - d.disputed.utc_seconds;
     }
   }
 
 
-  void _deal_expired(const deal& d)
+  // the last deal using a template takes the template with it
+  void _template_released(uint64_t template_id)
   {
-    if( d.flags & DEAL_DELIVERED_FLAG ) {
-      _deals.modify( d, _self, [&]( auto& item ) {
-          item.expires.utc_seconds = 0;
-          item.flags |= DEAL_ARBITRATION_FLAG;
+    const dealtemplate& tpl = _templates.get(template_id);
+    if( tpl.refs <= 1 ) {
+      _templates.erase(tpl);
+      return;
+    }
+    _templates.modify(tpl, same_payer, [&]( auto& item ) {
+        item.refs--;
       });
-      _notify(name("arbitration"),
-              "Goods Received was not issued on time. The deal is open for arbitration", d);
-      require_recipient(d.seller);
-      require_recipient(d.buyer);
-      require_recipient(d.arbiter);
+  }
+
+
+  void _arbitrate(uint64_t deal_id, name resolution)
+  {
+    auto dealitr = _deals.find(deal_id);
+    check(dealitr != _deals.end(), "Cannot find deal_id");
+    // a deal not in arbitration is reported before the missing authority
+    check((dealitr->flags & DEAL_ARBITRATION_FLAG), "The deal is not open for arbitration");
+    const name arbiter = dealitr->arbiter;
+    require_auth(arbiter);
+    payouts pay;
+    arbiter_closings closed;
+    _resolve_dispute(*dealitr, resolution, pay, closed);
+    _send_payouts(pay);
+    _arbiter_deals_closed(arbiter, closed);
+    _sweep_expired();
+  }
+
+
+  void _resolve_dispute(const deal& d, name resolution, payouts& pay, arbiter_closings& closed)
+  {
+    _check_transition<T_ARBITRATE>(d);
+    if( resolution == name("arbenforce") && d.milestone + 1 < d.milestones ) {
+      // the deal goes on with the next milestone
+      _release_milestone(d, resolution, pay, closed);
+      return;
+    }
+    if( resolution == name("arbrefund") ) {
+      _add_payout(pay, d.buyer, d, "canceled by arbitration");
+      _notify_closing(name("arbrefund"), "Deal canceled by arbitration, buyer got refunded", d);
+      _require_recipient(d.seller, EVENTS_CLOSED);
     }
     else {
-      string msg = string("Deal ") + to_string(d.id) + " expired";
-      if( d.flags & DEAL_FUNDED_FLAG ) {
-        _send_payment(d.buyer, d.price, msg); // refund the buyer
-        _notify(name("refund"), string("Deal ") + to_string(d.id) + " refunded", d);
+      check(resolution == name("arbenforce"), "Resolution must be arbrefund or arbenforce");
+      _add_payout(pay, d.seller, d, "enforced by arbitration");
+      _notify_closing(name("arbenforce"), "Deal enforced by arbitration, seller got paid", d);
+      _require_recipient(d.buyer, EVENTS_CLOSED);
+    }
+    _erase_deal(d, resolution, closed);
+  }
+
+
+  // stats of an arbiter, created from the profile if the arbiter
+  // registered before the stats table existed
+  const arbstat& _arbiter_stat(name account)
+  {
+    auto statitr = _arbstats.find(account.value);
+    if( statitr != _arbstats.end() ) {
+      return *statitr;
+    }
+    arbiters _arbiters(_self, _self.value);
+    const auto& arb = _arbiters.get(account.value, "Cannot find the arbiter");
+    return *_arbstats.emplace(_self, [&]( auto& item ) {
+        item.account = account;
+        item.is_active = arb.is_active;
+        item.country = _country_code(arb.iso_country);
+        item.processed_deals = arb.processed_deals;
+      });
+  }
+
+
+  // two-letter ISO country code as a number, 0 for an empty string
+  static uint16_t _country_code(const string& iso_country)
+  {
+    if( iso_country.empty() ) {
+      return 0;
+    }
+    check(iso_country.length() == 2, "ISO country code must be 2 letters");
+    for( char c : iso_country ) {
+      check('A' <= c && c <= 'Z', "Invalid character in ISO country code");
+    }
+    return (uint16_t(iso_country[0]) << 8) | uint16_t(iso_country[1]);
+  }
+
+
+  template<typename Index>
+  arbiter_page _query_arbiters(const Index& idx, uint16_t country, uint32_t from_processed,
+                               name from_account, uint16_t limit)
+  {
+    arbiter_page page { .more=false };
+    const uint128_t prefix = _directory_key(true, country, 0, name()) >> 96;
+    auto itr = idx.lower_bound(_directory_key(true, country, from_processed, from_account));
+    while( itr != idx.end() && (Index::extract_secondary_key(*itr) >> 96) == prefix ) {
+      if( page.arbiters.size() == limit ) {
+        page.more = true;
+        page.next_processed = itr->processed_deals;
+        page.next_account = itr->account;
+        break;
+      }
+      const uint32_t disputes = itr->refunds + itr->enforcements;
+      page.arbiters.push_back(arbiter_summary {
+          .account=itr->account,
+          .iso_country=itr->country ? string{ char(itr->country >> 8), char(itr->country & 0xFF) } : string(),
+          .processed_deals=itr->processed_deals, .open_deals=itr->open_deals,
+          .open_disputes=itr->open_disputes, .refunds=itr->refunds, .enforcements=itr->enforcements,
+          .avg_resolution_sec=disputes ? itr->resolution_sec / disputes : 0 });
+      itr++;
+    }
+    return page;
+  }
+
+
+  void _arbiter_deal_opened(name arbiter, bool disputed = false)
+  {
+    _arbstats.modify(_arbiter_stat(arbiter), same_payer, [&]( auto& item ) {
+        item.open_deals++;
+        if( disputed ) {
+          item.open_disputes++;
+        }
+      });
+  }
+
+
+  // apply the stats changes of deals closed in an action, and delete a
+  // retired arbiter when its last open deal is closed
+  void _arbiter_deals_closed(name arbiter, const arbiter_closings& closed)
+  {
+    if( closed.deals == 0 && closed.disputes == 0 ) {
+      return;
+    }
+    auto statitr = _arbstats.find(arbiter.value);
+    if( statitr == _arbstats.end() ) {
+      return;
+    }
+    _arbstats.modify(*statitr, same_payer, [&]( auto& item ) {
+        item.open_deals -= std::min(item.open_deals, closed.deals);
+        item.open_disputes -= std::min(item.open_disputes, closed.disputes);
+        item.processed_deals += closed.refunds + closed.enforcements;
+        item.refunds += closed.refunds;
+        item.enforcements += closed.enforcements;
+        item.resolution_sec += closed.resolution_sec;
+      });
+    if( statitr->open_deals == 0 && !statitr->is_active && !_arbiter_has_old_deals(arbiter) ) {
+      _delete_arbiter(arbiter);
+    }
+  }
+
+
+  // deals not yet migrated are not counted in arbstats, and migrate
+  // needs the arbiter of each of them
+  bool _arbiter_has_old_deals(name arbiter)
+  {
+    olddeals _olddeals(_self, _self.value);
+    auto idx = _olddeals.get_index<name("arbiters")>();
+    auto itr = idx.lower_bound(arbiter.value);
+    return itr != idx.end() && itr->arbiter == arbiter;
+  }
+
+
+  void _delete_arbiter(name account)
+  {
+    arbiters _arbiters(_self, _self.value);
+    _arbiters.erase(_arbiters.get(account.value, "Cannot find the arbiter"));
+    auto statitr = _arbstats.find(account.value);
+    if( statitr != _arbstats.end() ) {
+      _arbstats.erase(statitr);
+    }
+    // leave trace
+    action(
+           permission_level{_self, name("active")},
+           _self, 
+           name("arbdeleted"), 
+           std::make_tuple(account)
+           ).send();        
+  }
+
+  
+  telemetryconf _tmconf;
+  telemetry _tm;
+  bool _tm_loaded = false;
+  bool _tm_dirty = false;
+
+  checkpoint _cp;
+  bool _cp_loaded = false;
+  bool _cp_new = false;
+  bool _cp_dirty = false;
+
+  // Add the receipt of a closing deal to the last checkpoint, or to a new
+  // one if the period has changed or the last one is full. The last
+  // checkpoint is read once and written by the destructor.
+  void _fold_receipt(name outcome, const deal& d)
+  {
+    const time_point_sec now(current_time_point());
+    const uint64_t period = now.utc_seconds / CHECKPOINT_PERIOD_SEC;
+    if( !_cp_loaded ) {
+      auto last = _checkpoints.end();
+      if( last != _checkpoints.begin() ) {
+        _cp = *--last;
       }
       else {
-        require_recipient(d.buyer);  // in case of a payback, the buyer is already notified
+        _cp = checkpoint { .id=0, .period=period, .receipts=0 };
+        _cp_new = true;
+      }
+      _cp_loaded = true;
+    }
+    if( _cp.period != period || _cp.receipts == CHECKPOINT_MAX_RECEIPTS ) {
+      if( _cp_dirty ) {
+        _save_checkpoint();
       }
-      require_recipient(d.seller);
-      _notify(name("expired"), msg, d);
-      _deals.erase(d);
+      const checkpoint next { .id=_cp.id + 1, .period=period, .start=_cp.head, .head=_cp.head, .receipts=0 };
+      _cp = next;
+      _cp_new = true;
+    }
+    const closing_receipt r {
+      .deal_id=d.id, .buyer=d.buyer, .seller=d.seller, .arbiter=d.arbiter, .price=d.price,
+      .outcome=outcome, .funded=(d.flags & DEAL_FUNDED_FLAG) ? d.funded : time_point_sec(),
+      .closed=now };
+    _cp.head = _chain_hash(_cp.head, _receipt_digest(r));
+    _cp.receipts++;
+    _cp_dirty = true;
+  }
+
+
+  void _save_checkpoint()
+  {
+    if( _cp_new ) {
+      _checkpoints.emplace(_self, [&]( auto& item ) { item = _cp; });
+      _cp_new = false;
+    }
+    else {
+      _checkpoints.modify(_checkpoints.get(_cp.id), same_payer, [&]( auto& item ) { item = _cp; });
+    }
+    _cp_dirty = false;
+  }
+
+  // telemetry as stored, read once per action. Until the singleton is
+  // first written, the counters are seeded from the deals already open,
+  // so callers load it before they add or change a deal.
+  const telemetry& _stored_telemetry()
+  {
+    if( !_tm_loaded ) {
+      _tm = _tmconf.get_or_default();
+      _tm_loaded = true;
+      if( _tm.actions == 0 ) {
+        for( const auto& d : _deals ) {
+          _tm.open_deals++;
+          _count_flags(0, d.flags);
+        }
+      }
+    }
+    return _tm;
+  }
+
+
+  // telemetry of the action, written by the destructor
+  telemetry& _telemetry()
+  {
+    _stored_telemetry();
+    _tm_dirty = true;
+    return _tm;
+  }
+
+
+  // Checks that the deal is in a state where the transition applies and
+  // that party may take it. Without a party, one of the parties allowed
+  // by the transition must have authorized the action. The checks run in
+  // the order of the actions before the table: arbitration, expiration,
+  // the other flags, then the party.
+  template<transition_id T>
+  void _check_transition(const deal& d, name party = name())
+  {
+    constexpr transition t = TRANSITIONS[T];
+    // a deal in arbitration has no expiration time, so that comes first
+    if constexpr( (t.excluded & DEAL_ARBITRATION_FLAG) != 0 ) {
+      check((d.flags & DEAL_ARBITRATION_FLAG) == 0, "The deal is in arbitration");
+    }
+    if constexpr( t.live ) {
+      check(d.expires > time_point_sec(current_time_point()), "The deal is expired");
+    }
+    if( (d.flags & t.required) != t.required || (d.flags & t.excluded) != 0 ) {
+      _transition_error(d.flags, t.required, t.excluded);
+    }
+    if constexpr( t.parties != 0 ) {
+      bool allowed = false;
+      if( party == name() ) {
+        allowed = ((t.parties & BY_BUYER) && has_auth(d.buyer)) ||
+          ((t.parties & BY_SELLER) && has_auth(d.seller)) ||
+          ((t.parties & BY_ARBITER) && has_auth(d.arbiter));
+      }
+      else {
+        allowed = ((t.parties & BY_BUYER) && party == d.buyer) ||
+          ((t.parties & BY_SELLER) && party == d.seller) ||
+          ((t.parties & BY_ARBITER) && party == d.arbiter);
+      }
+      check(allowed, t.party_error);
+    }
+  }
+
+
+  // reports the first flag that does not match, kept out of line
+  [[gnu::noinline]]
+  static void _transition_error(uint16_t flags, uint16_t required, uint16_t excluded)
+  {
+    for( int bit = 0; bit < 5; bit++ ) {
+      const uint16_t flag = 1 << bit;
+      check(!(required & flag) || (flags & flag), FLAG_MISSING_ERRORS[bit]);
+      check(!(excluded & flag) || !(flags & flag), FLAG_PRESENT_ERRORS[bit]);
+    }
+  }
+
+
+  template<transition_id T>
+  bool _apply_transition(const deal& d, name payer)
+  {
+    return _apply_transition<T>(d, payer, []( auto& ) {});
+  }
+
+
+  // Sets the flags and expiration time of the deal after the transition.
+  // update makes the other changes of the action to the deal row before
+  // the expiration time is set, in the same write. Returns true if the
+  // transition is to be reported in a notification, which then carries
+  // the next event sequence number.
+  template<transition_id T, typename Update>
+  bool _apply_transition(const deal& d, name payer, Update&& update)
+  {
+    constexpr transition t = TRANSITIONS[T];
+    static_assert(t.expires != expiry::close, "closing transitions erase the deal");
+    const uint16_t flags = (d.flags | t.sets) & ~t.clears;
+    const bool reported = (flags & t.reported) == t.reported;
+    _count_flags(d.flags, flags);
+    _deals.modify( d, payer, [&]( auto& item ) {
+        const time_point_sec now(current_time_point());
+        item.flags = flags;
+        update(item);
+        if constexpr( (t.sets & DEAL_FUNDED_FLAG) != 0 ) {
+          item.funded = now;
+        }
+        if constexpr( t.expires == expiry::start_term ) {
+          if( (flags & BOTH_ACCEPTED_FLAG) == BOTH_ACCEPTED_FLAG ) {
+            if( flags & DEAL_FUNDED_FLAG ) {
+              // the delivery term starts when the deal is both paid and accepted
+              item.term_start = now;
+              item.expires = now + (item.days * DAY_SEC);
+            }
+            else {
+              item.expires = now + ACCEPTED_DEAL_EXPIRES;
+            }
+          }
+        }
+        else if constexpr( t.expires == expiry::delivery_term ) {
+          item.expires = item.term_start + (item.days * DAY_SEC);
+        }
+        else if constexpr( t.expires == expiry::delivered ) {
+          item.expires = now + DELIVERED_DEAL_EXPIRES;
+        }
+        else if constexpr( t.expires == expiry::dispute ) {
+          item.disputed = now;
+          item.expires.utc_seconds = 0;
+        }
+        else if constexpr( t.expires == expiry::next_term ) {
+          item.term_start = now;
+          item.disputed = time_point_sec();
+          item.expires = now + (item.days * DAY_SEC);
+        }
+        if( reported ) {
+          item.evseq++;
+        }
+      });
+    return reported;
+  }
+
+
+  // count open deals per flag as a deal goes from one set of flags to another
+  void _count_flags(uint16_t before, uint16_t after)
+  {
+    if( before == after ) {
+      return;
+    }
+    telemetry& tm = _telemetry();
+    auto count = [&]( uint16_t flag, uint32_t& counter ) {
+      if( (after & flag) && !(before & flag) ) {
+        counter++;
+      }
+      else if( (before & flag) && !(after & flag) ) {
+        counter--;
+      }
+    };
+    count(BUYER_ACCEPTED_FLAG, tm.buyer_accepted);
+    count(SELLER_ACCEPTED_FLAG, tm.seller_accepted);
+    count(DEAL_FUNDED_FLAG, tm.funded);
+    count(DEAL_DELIVERED_FLAG, tm.delivered);
+    count(DEAL_ARBITRATION_FLAG, tm.arbitration);
+  }
+
+
+  // add a deposit to the escrowed amount of its token, or take a payout off it
+  void _ledger_update(const extended_asset& x, bool deposit)
+  {
+    ledger _ledger(_self, x.contract.value);
+    auto itr = _ledger.find(x.quantity.symbol.code().raw());
+    if( itr == _ledger.end() ) {
+      if( deposit ) {
+        _ledger.emplace(_self, [&]( auto& item ) {
+            item.escrowed = x.quantity;
+          });
+      }
+      return;
+    }
+    _ledger.modify(*itr, same_payer, [&]( auto& item ) {
+        if( deposit ) {
+          item.escrowed += x.quantity;
+        }
+        else {
+          item.escrowed.amount -= std::min(item.escrowed.amount, x.quantity.amount);
+        }
+      });
+  }
+
+
+  int _token_mode = -1;
+
+  uint8_t _get_token_mode()
+  {
+    if( _token_mode < 0 ) {
+      props _props(_self, _self.value);
+      _token_mode = _get_prop(_props, name("tokenmode"), TOKENS_OPEN);
+    }
+    return _token_mode;
+  }
+
+
+  // registry entry of a token, checking that the symbol matches it
+  token _get_token(name contract, symbol sym)
+  {
+    tokens _tokens(_self, contract.value);
+    auto tkitr = _tokens.find(sym.code().raw());
+    check(tkitr != _tokens.end(), "This token is not supported");
+    check(tkitr->sym == sym, "Invalid token precision");
+    return *tkitr;
+  }
+
+
+  int _compact_mode = -1;
+
+  bool _compact_notify()
+  {
+    if( _compact_mode < 0 ) {
+      props _props(_self, _self.value);
+      _compact_mode = _get_prop(_props, name("compactntf"), 0);
+    }
+    return _compact_mode;
+  }
+
+
+  // require_recipient, unless the account is not subscribed to the event class
+  void _require_recipient(name account, uint8_t event_class)
+  {
+    if( _has_subscriptions < 0 ) {
+      _has_subscriptions = (_subscriptions.begin() != _subscriptions.end());
+    }
+    if( !_has_subscriptions ) {
+      require_recipient(account);
+      return;
+    }
+    auto [itr, added] = _subscribed.emplace(account.value, EVENTS_ALL);
+    if( added ) {
+      auto subitr = _subscriptions.find(account.value);
+      if( subitr != _subscriptions.end() ) {
+        itr->second = subitr->events;
+      }
+    }
+    if( itr->second & event_class ) {
+      require_recipient(account);
     }
   }
 
 
-  
   // leave a trace in history
-  void _notify(name deal_status, const string message, const deal& d)
+  void _notify(name deal_status, string_view message, const deal& d)
+  {
+    if( _compact_notify() ) {
+      _send_event(deal_status, d, d.evseq);
+      return;
+    }
+    _send_full_notification(deal_status, message, d);
+  }
+
+
+  // same as _notify, for the last event before the deal is erased
+  void _notify_closing(name deal_status, string_view message, const deal& d)
+  {
+    telemetry& tm = _telemetry();
+    if( deal_status == name("closed") ) {
+      tm.closed++;
+    } else if( deal_status == name("canceled") ) {
+      tm.canceled++;
+    } else if( deal_status == name("expired") ) {
+      tm.expired++;
+    } else {
+      tm.arbitrated++;
+    }
+    _fold_receipt(deal_status, d);
+    if( _compact_notify() ) {
+      _send_event(deal_status, d, d.evseq + 1);
+      return;
+    }
+    _send_full_notification(deal_status, message, d);
+  }
+
+
+  void _send_event(name deal_status, const deal& d, uint32_t seq)
+  {
+    deal_event_abi e {
+      .deal_id=d.id, .deal_status=deal_status, .seq=seq, .flags=d.flags,
+      .funded=d.funded, .expires=d.expires, .days=d.days };
+    if( d.milestones > 0 ) {
+      e.remaining.emplace(d.price.quantity.amount);
+    }
+    action {
+      permission_level{_self, name("active")},
+      _self,
+      name("dealevent"),
+      e
+    }.send();
+  }
+
+
+  // packed in the layout of deal_notification_abi, without copying the texts
+  void _send_full_notification(name deal_status, string_view message, const deal& d)
   {
+    const dealtext& t = _texts.get(d.id);
+    binary_extension<uint64_t> template_id;
+    if( t.template_id != 0 ) {
+      template_id.emplace(t.template_id);
+    }
     action {
       permission_level{_self, name("active")},
       _self,
       name("notify"),
-      deal_notification_abi {
-        .deal_status=deal_status,
-        .message=message,
-        .deal_id=d.id, .created_by=d.created_by, .description=d.description,
-        .tkcontract=d.price.contract, .quantity=d.price.quantity,
-        .buyer=d.buyer, .seller=d.seller, .arbiter=d.arbiter, .days=d.days,
-        .delivery_memo=d.delivery_memo }
+      std::forward_as_tuple(deal_status, message, d.id, d.created_by, t.description,
+                            d.price.contract, d.price.quantity,
+                            d.buyer, d.seller, d.arbiter, d.days, t.delivery_memo, template_id)
     }.send();
   }
   
 
-  void _send_payment(name recipient, const extended_asset& x, const string memo)
+  void _add_payout(payouts& pay, name recipient, const deal& d, string_view reason)
+  {
+    _add_payout(pay, recipient, d, d.price.quantity, reason);
+  }
+
+
+  // part of the escrowed amount of a deal, as for a milestone
+  void _add_payout(payouts& pay, name recipient, const deal& d, const asset& amount, string_view reason)
+  {
+    payout& p = pay[std::make_tuple(recipient.value, d.price.contract.value,
+                                    d.price.quantity.symbol.raw())];
+    if( p.deals == 0 ) {
+      p.total = extended_asset(amount, d.price.contract);
+      p.reason = reason;
+    }
+    else {
+      p.total.quantity += amount;
+      p.deal_ids += ',';
+      if( p.reason != reason ) {
+        p.reason = "escrow payout";
+      }
+    }
+    p.deal_ids += to_string(d.id);
+    p.deals++;
+  }
+
+
+  // one transfer per recipient and token. The memo lists the deal IDs
+  // if they fit in a token memo
+  void _send_payouts(const payouts& pay)
+  {
+    string memo;
+    memo.reserve(256);
+    for( const auto& [key, p] : pay ) {
+      memo.assign(p.deals == 1 ? "Deal " : "Deals ");
+      memo += p.deal_ids;
+      if( memo.size() + 2 + p.reason.size() > 256 ) {
+        memo.assign(to_string(p.deals));
+        memo += " deals";
+      }
+      memo += ": ";
+      memo += p.reason;
+      _send_payment(name(std::get<0>(key)), p.total, memo);
+    }
+  }
+
+
+  void _cancel_deal(uint64_t deal_id, payouts& pay)
+  {
+    auto dealitr = _deals.find(deal_id);
+    check(dealitr != _deals.end(), "Cannot find deal_id");
+    const deal& d = *dealitr;
+
+    if( (d.flags & DEAL_FUNDED_FLAG) == 0 ) {
+      // not funded, so any of the parties can cancel the deal
+      _check_transition<T_CANCEL>(d);
+    }
+    else if( (d.flags & SELLER_ACCEPTED_FLAG) == 0 ) {
+      // paid at creation and not accepted yet, so the buyer can withdraw
+      _check_transition<T_CANCEL_PREPAID>(d);
+      _add_payout(pay, d.buyer, d, "canceled before acceptance");
+      if( !_compact_notify() ) {
+        _notify(name("refunded"), "Deal canceled before acceptance, buyer got refunded", d);
+      }
+    }
+    else {
+      // funded, so only seller can cancel the deal
+      _check_transition<T_CANCEL_FUNDED>(d);
+      _add_payout(pay, d.buyer, d, "canceled by seller");
+      if( !_compact_notify() ) {
+        _notify(name("refunded"), "Deal canceled by seller, buyer got refunded", d);
+      }
+    }
+    
+    _notify_closing(name("canceled"), "The deal is canceled", d);    
+    _erase_deal(d);
+  }
+
+
+  void _goods_received(uint64_t deal_id, payouts& pay)
+  {
+    auto dealitr = _deals.find(deal_id);
+    check(dealitr != _deals.end(), "Cannot find deal_id");
+    const deal& d = *dealitr;
+
+    _check_transition<T_GOODS_RECEIVED>(d);
+
+    if( d.milestone + 1 < d.milestones ) {
+      const name arbiter = d.arbiter;
+      arbiter_closings closed;
+      _release_milestone(d, name(), pay, closed);
+      _arbiter_deals_closed(arbiter, closed);
+      return;
+    }
+
+    _add_payout(pay, d.seller, d, "goods received, deal closed");
+    _notify_closing(name("closed"), "Goods received, deal closed", d);
+    if( d.flags & DEAL_ARBITRATION_FLAG ) {
+      _require_recipient(d.arbiter, EVENTS_CLOSED);
+    }
+    _erase_deal(d);
+  }
+
+
+  // Pay the current milestone of a milestone deal to the seller and start
+  // the term of the next one. The deal row keeps the rest of the escrowed
+  // amount, so that expiration and cancellation refund only the rest.
+  void _release_milestone(const deal& d, name resolution, payouts& pay, arbiter_closings& closed)
+  {
+    _check_transition<T_MILESTONE>(d);
+    const dealtext& t = _texts.get(d.id);
+    const asset amount = t.milestones[d.milestone].amount;
+    const uint32_t next_days = t.milestones[d.milestone + 1].days;
+    const bool disputed = d.flags & DEAL_ARBITRATION_FLAG;
+    _count_resolution(d, resolution, closed);
+    _add_payout(pay, d.seller, d, amount, "milestone released");
+    _apply_transition<T_MILESTONE>(d, _self, [&]( auto& item ) {
+        item.price.quantity -= amount;
+        item.milestone++;
+        item.days = next_days;
+      });
+    if( resolution == name("arbenforce") ) {
+      _notify(name("arbmilestone"), "Milestone enforced by arbitration, seller got paid", d);
+    }
+    else {
+      _notify(name("milestone"), "Milestone released, seller got paid", d);
+    }
+    _require_recipient(d.seller, EVENTS_CLOSED);
+    if( disputed ) {
+      _require_recipient(d.buyer, EVENTS_CLOSED);
+      _require_recipient(d.arbiter, EVENTS_CLOSED);
+    }
+  }
+
+
+  void _send_payment(name recipient, const extended_asset& x, string_view memo)
   {
+    _ledger_update(x, false);
+    // packed in the layout of transfer, without copying the memo
     action
       {
         permission_level{_self, name("active")},
         x.contract,
         name("transfer"),
-        transfer  {
-          .from=_self, .to=recipient,
-          .quantity=x.quantity, .memo=memo
-        }
+        std::forward_as_tuple(_self, recipient, x.quantity, memo)
       }.send();
   }
   
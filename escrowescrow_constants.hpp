@@ -1,8 +1,28 @@
-const int WIPE_EXP_DEALS_TAX = 3; // delete up to so many expired deals in every action
-const unsigned int WIPE_EXP_TX_DELAY = 10; // deferred transaction delay, seconds
+const uint16_t SWEEP_MIN_BUDGET = 3;  // expired deals processed by every action, by default
+const uint16_t SWEEP_MAX_BUDGET = 48; // upper limit for the budget while there is a backlog
 
 const int NEW_DEAL_EXPIRES = 3*3600*24;
 const int ACCEPTED_DEAL_EXPIRES = 3*3600*24;
 const int DELIVERED_DEAL_EXPIRES = 3*3600*24;
 
 const int DAY_SEC = 24*3600;
+
+const uint32_t CHECKPOINT_PERIOD_SEC = 24*3600; // closed-deal receipts folded into one checkpoint
+const uint32_t CHECKPOINT_MAX_RECEIPTS = 512;   // receipts per checkpoint, bounds the proof of one
+
+const uint64_t FIRST_SEQ_DEAL_ID = 1ULL << 32; // sequential deal IDs start above legacy 32-bit IDs
+
+const uint16_t QUERY_MAX_LIMIT = 100; // deals returned by one getdeals call, at most
+const uint16_t QUERY_MAX_SCAN = 500;  // index entries visited by one getdeals call, at most
+
+const uint8_t MAX_MILESTONES = 32;    // payment tranches of one milestone deal, at most
+
+// event classes that an account can subscribe to with subscribe
+const uint8_t EVENTS_NEW          = 1 << 0;
+const uint8_t EVENTS_ACCEPTED     = 1 << 1;
+const uint8_t EVENTS_FUNDED       = 1 << 2; // also extended delivery terms
+const uint8_t EVENTS_DELIVERED    = 1 << 3;
+const uint8_t EVENTS_CLOSED       = 1 << 4; // goods received and arbitration decisions
+const uint8_t EVENTS_ARBITRATION  = 1 << 5;
+const uint8_t EVENTS_EXPIRED      = 1 << 6;
+const uint8_t EVENTS_ALL          = (1 << 7) - 1; // default for accounts without a subscription
@@ -0,0 +1,141 @@
+/*
+  Deal lifecycle of escrowescrow as a compile-time transition table.
+
+  Every action that changes a deal looks up its row in TRANSITIONS by a
+  template argument, so the checks of a row compile down to a couple of
+  bit tests on the deal flags. A new step in the lifecycle is a new row
+  here and a call of _check_transition/_apply_transition in the action.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+// deal flags
+constexpr uint16_t BUYER_ACCEPTED_FLAG    = 1 << 0;
+constexpr uint16_t SELLER_ACCEPTED_FLAG   = 1 << 1;
+constexpr uint16_t DEAL_FUNDED_FLAG       = 1 << 2;
+constexpr uint16_t DEAL_DELIVERED_FLAG    = 1 << 3;
+constexpr uint16_t DEAL_ARBITRATION_FLAG  = 1 << 4;
+
+constexpr uint16_t BOTH_ACCEPTED_FLAG = BUYER_ACCEPTED_FLAG | SELLER_ACCEPTED_FLAG;
+
+// errors for a flag that must be set, and for a flag that must be clear,
+// in the order of the flag bits
+constexpr const char* FLAG_MISSING_ERRORS[] = {
+  "The deal is not accepted yet by the buyer",
+  "The deal is not accepted yet by the seller",
+  "The deal is not funded yet",
+  "The deal is not marked as delivered",
+  "The deal is not open for arbitration" };
+
+constexpr const char* FLAG_PRESENT_ERRORS[] = {
+  "Buyer has already accepted this deal",
+  "Seller has already accepted this deal",
+  "The deal is already funded",
+  "The deal is already marked as delivered",
+  "The deal is in arbitration" };
+
+// parties that can take a transition; none for the contract itself
+constexpr uint8_t BY_BUYER    = 1 << 0;
+constexpr uint8_t BY_SELLER   = 1 << 1;
+constexpr uint8_t BY_ARBITER  = 1 << 2;
+
+// how a transition moves the expiration time of the deal
+enum class expiry : uint8_t {
+  keep,           // unchanged
+  start_term,     // once both parties accepted: the delivery term from now if
+                  // funded, the funding deadline otherwise
+  delivery_term,  // the delivery term from the start of the current term
+  delivered,      // the goods received deadline from now
+  dispute,        // no expiration while in arbitration
+  next_term,      // the delivery term of the next milestone from now
+  close           // the deal is erased
+};
+
+struct transition {
+  uint8_t     parties;
+  bool        live;          // the deal must not be expired
+  uint16_t    required;      // flags that must be set
+  uint16_t    excluded;      // flags that must be clear
+  uint16_t    sets;          // flags set by the transition
+  uint16_t    clears;        // flags cleared by the transition
+  uint16_t    reported;      // flags that must all be set after the transition for it
+                             // to be reported in a notification
+  expiry      expires;
+  const char* party_error;
+};
+
+enum transition_id : uint8_t {
+  T_BUYER_ACCEPT,
+  T_SELLER_ACCEPT,
+  T_FUND,             // transfer for an accepted deal
+  T_PREPAY,           // transfer that creates the deal
+  T_DELIVER,
+  T_EXTEND,
+  T_GOODS_RECEIVED,
+  T_CANCEL,           // not funded
+  T_CANCEL_PREPAID,   // funded at creation, not accepted by the seller
+  T_CANCEL_FUNDED,
+  T_DISPUTE,          // goods received deadline passed
+  T_ARBITRATE,
+  T_MILESTONE,        // payment of a milestone, the next one starts
+  T_COUNT
+};
+
+constexpr transition TRANSITIONS[T_COUNT] = {
+  // T_BUYER_ACCEPT
+  { BY_BUYER, true, 0, BUYER_ACCEPTED_FLAG, BUYER_ACCEPTED_FLAG, 0, BOTH_ACCEPTED_FLAG,
+    expiry::start_term, "Deal can only be accepted by either seller or buyer" },
+  // T_SELLER_ACCEPT
+  { BY_SELLER, true, 0, SELLER_ACCEPTED_FLAG, SELLER_ACCEPTED_FLAG, 0, BOTH_ACCEPTED_FLAG,
+    expiry::start_term, "Deal can only be accepted by either seller or buyer" },
+  // T_FUND
+  { BY_BUYER, true, BOTH_ACCEPTED_FLAG, DEAL_FUNDED_FLAG, DEAL_FUNDED_FLAG, 0, 0,
+    expiry::start_term, "The deal can only funded by buyer" },
+  // T_PREPAY
+  { BY_BUYER, true, BUYER_ACCEPTED_FLAG, DEAL_FUNDED_FLAG, DEAL_FUNDED_FLAG, 0, 0,
+    expiry::start_term, "The deal can only funded by buyer" },
+  // T_DELIVER
+  { BY_SELLER, true, DEAL_FUNDED_FLAG | SELLER_ACCEPTED_FLAG, DEAL_DELIVERED_FLAG, DEAL_DELIVERED_FLAG, 0, 0,
+    expiry::delivered, "Only seller can mark a deal as delivered" },
+  // T_EXTEND
+  { BY_BUYER, true, DEAL_FUNDED_FLAG | SELLER_ACCEPTED_FLAG, 0, 0, 0, 0,
+    expiry::delivery_term, "Only buyer can extend a deal" },
+  // T_GOODS_RECEIVED: also after delivery deadline, and in arbitration
+  { BY_BUYER, false, DEAL_FUNDED_FLAG, 0, 0, 0, 0,
+    expiry::close, "Only buyer can sign-off Goods Received" },
+  // T_CANCEL
+  { BY_BUYER | BY_SELLER, true, 0, DEAL_FUNDED_FLAG | DEAL_ARBITRATION_FLAG, 0, 0, 0,
+    expiry::close, "Only seller or buyer can cancel the deal" },
+  // T_CANCEL_PREPAID
+  { BY_BUYER | BY_SELLER, true, DEAL_FUNDED_FLAG, SELLER_ACCEPTED_FLAG | DEAL_ARBITRATION_FLAG, 0, 0, 0,
+    expiry::close, "Only seller or buyer can cancel the deal" },
+  // T_CANCEL_FUNDED
+  { BY_SELLER, true, DEAL_FUNDED_FLAG | SELLER_ACCEPTED_FLAG, DEAL_DELIVERED_FLAG | DEAL_ARBITRATION_FLAG, 0, 0, 0,
+    expiry::close, "The deal is funded, so only seller can cancel it" },
+  // T_DISPUTE
+  { 0, false, DEAL_DELIVERED_FLAG, DEAL_ARBITRATION_FLAG, DEAL_ARBITRATION_FLAG, 0, 0,
+    expiry::dispute, "" },
+  // T_ARBITRATE
+  { BY_ARBITER, false, DEAL_ARBITRATION_FLAG, 0, 0, 0, 0,
+    expiry::close, "Only the arbiter of the deal can resolve it" },
+  // T_MILESTONE: on goods received, or enforced by the arbiter
+  { BY_BUYER | BY_ARBITER, false, DEAL_FUNDED_FLAG | SELLER_ACCEPTED_FLAG, 0,
+    0, DEAL_DELIVERED_FLAG | DEAL_ARBITRATION_FLAG, 0,
+    expiry::next_term, "Only buyer or arbiter can release a milestone" },
+};
+
+// a transition cannot require a flag that it excludes or sets, or set
+// a flag that it clears
+constexpr bool transitions_valid()
+{
+  for( const auto& t : TRANSITIONS ) {
+    if( (t.required & t.excluded) != 0 || (t.sets & t.required) != 0 || (t.sets & t.clears) != 0 ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(transitions_valid(), "a transition requires a flag that it excludes or sets, or sets a flag that it clears");
@@ -0,0 +1,795 @@
+/*
+  Off-chain deal indexer for escrowescrow.
+
+  Reads a dump of escrowescrow action traces (see trace.hpp) and keeps
+  the current state and the history of every deal in memory-mapped
+  files, so the index survives restarts and is extended from where it
+  stopped instead of being rebuilt from genesis.
+
+  Files in the index directory:
+
+  * meta.dat: position in the dump and record counts;
+  * deals.dat: one fixed-size record per deal, in order of creation.
+    Every record is linked into four lists: deals of the same buyer,
+    seller, arbiter and token;
+  * events.dat: one fixed-size record per trace, in order of execution,
+    linked into a list per deal;
+  * keys.dat: open-addressing hash table from deal ID, party, arbiter or
+    token to the head of the corresponding list.
+
+  Usage:
+    escrow_indexer DIR ingest DUMP [--follow]
+    escrow_indexer DIR deal ID
+    escrow_indexer DIR buyer|seller|arbiter ACCOUNT
+    escrow_indexer DIR token CONTRACT PRECISION,SYMBOL
+    escrow_indexer DIR created FROM_MS TO_MS
+    escrow_indexer DIR events FROM_MS TO_MS
+    escrow_indexer DIR volume
+    escrow_indexer DIR arbstats
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <eosio/asset.hpp>
+#include <eosio/binary_extension.hpp>
+#include <eosio/datastream.hpp>
+#include <eosio/name.hpp>
+#include <eosio/time.hpp>
+
+#include "trace.hpp"
+
+using eosio::asset;
+using eosio::name;
+using eosio::symbol;
+using eosio::symbol_code;
+using eosio::time_point_sec;
+using std::string;
+using std::vector;
+
+namespace {
+
+  // action data of the traces, as declared in escrowescrow.cpp
+  struct deal_notification_abi {
+    name        deal_status;
+    string      message;
+    uint64_t    deal_id;
+    name        created_by;
+    string      description;
+    name        tkcontract;
+    asset       quantity;
+    name        buyer;
+    name        seller;
+    name        arbiter;
+    uint32_t    days;
+    string      delivery_memo;
+  };
+
+  struct deal_event_abi {
+    uint64_t       deal_id;
+    name           deal_status;
+    uint32_t       seq;
+    uint16_t       flags;
+    time_point_sec funded;
+    time_point_sec expires;
+    uint32_t       days;
+    eosio::binary_extension<int64_t> remaining; // milestone deals only
+  };
+
+  struct arbdeleted_abi {
+    name        arbiter;
+  };
+
+
+  const uint64_t INDEX_MAGIC = 0x3178646977726365ULL; // "ecrwidx1"
+  const uint32_t INDEX_VERSION = 2;
+
+  struct meta_rec {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t last_global_sequence;
+    uint64_t dump_offset;        // bytes of the dump consumed so far
+    uint64_t deals;
+    uint64_t events;
+    uint64_t keys_used;
+    uint64_t orphan_events;      // compact events for deals created before the dump started
+  };
+
+  enum list_kind { BY_BUYER = 0, BY_SELLER = 1, BY_ARBITER = 2, BY_TOKEN = 3, LIST_KINDS = 4 };
+
+  struct deal_rec {
+    uint64_t id;
+    uint64_t created_by;
+    uint64_t buyer;
+    uint64_t seller;
+    uint64_t arbiter;
+    uint64_t tkcontract;
+    uint64_t symbol;
+    int64_t  amount;
+    int64_t  released;           // paid out in milestones before the deal closed
+    uint64_t status;             // last deal_status
+    uint64_t created_ms;
+    uint64_t updated_ms;
+    uint64_t funded_ms;
+    uint64_t delivered_ms;
+    uint64_t arbitration_ms;
+    uint64_t closed_ms;
+    uint32_t expires;
+    uint32_t days;
+    uint32_t flags;              // from compact events; 0 in full notification mode
+    uint32_t events;
+    uint64_t last_event;         // event index + 1, 0 if none
+    uint64_t next[LIST_KINDS];   // next older deal in the same list, index + 1
+  };
+
+  struct event_rec {
+    uint64_t subject;            // deal ID, or arbiter for arbdeleted
+    uint64_t status;
+    uint64_t time_ms;
+    uint64_t global_sequence;
+    uint64_t prev;               // previous event of the same deal, index + 1
+  };
+
+  // key kinds for deal IDs and accounts; token keys use the raw symbol,
+  // which is always above 255
+  const uint64_t KEY_ID = 1;
+  const uint64_t KEY_BUYER = 2;
+  const uint64_t KEY_SELLER = 3;
+  const uint64_t KEY_ARBITER = 4;
+
+  const uint32_t KEY_ARBITER_RETIRED = 1;
+
+  struct key_rec {
+    uint64_t a;                  // deal ID, account or token contract
+    uint64_t b;                  // key kind or raw symbol, 0 for an empty slot
+    uint64_t head;               // deal index + 1
+    uint32_t count;
+    uint32_t flags;
+  };
+
+
+  [[noreturn]] void fail(const string& msg)
+  {
+    throw std::runtime_error(msg);
+  }
+
+
+  // A file of fixed-size records mapped into memory, grown by doubling
+  template<typename T>
+  class mapped_array {
+  public:
+    ~mapped_array() { close(); }
+
+    void open(const string& path, size_t min_capacity)
+    {
+      _path = path;
+      _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+      if( _fd < 0 ) fail("cannot open " + path + ": " + strerror(errno));
+      struct stat st;
+      if( fstat(_fd, &st) != 0 ) fail("cannot stat " + path);
+      size_t capacity = st.st_size / sizeof(T);
+      map(std::max(capacity, min_capacity));
+    }
+
+    void close()
+    {
+      if( _data != nullptr ) {
+        msync(_data, _capacity * sizeof(T), MS_SYNC);
+        munmap(_data, _capacity * sizeof(T));
+        _data = nullptr;
+      }
+      if( _fd >= 0 ) {
+        ::close(_fd);
+        _fd = -1;
+      }
+    }
+
+    void reserve(size_t n)
+    {
+      if( n > _capacity ) {
+        size_t c = _capacity;
+        while( c < n ) c *= 2;
+        munmap(_data, _capacity * sizeof(T));
+        _data = nullptr;
+        map(c);
+      }
+    }
+
+    void sync() { msync(_data, _capacity * sizeof(T), MS_SYNC); }
+
+    size_t capacity() const { return _capacity; }
+    const string& path() const { return _path; }
+    T& operator[](size_t i) { return _data[i]; }
+    const T& operator[](size_t i) const { return _data[i]; }
+
+  private:
+    void map(size_t capacity)
+    {
+      if( ftruncate(_fd, capacity * sizeof(T)) != 0 ) fail("cannot resize " + _path);
+      void* p = mmap(nullptr, capacity * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+      if( p == MAP_FAILED ) fail("cannot map " + _path + ": " + strerror(errno));
+      _data = static_cast<T*>(p);
+      _capacity = capacity;
+    }
+
+    string _path;
+    int _fd = -1;
+    T* _data = nullptr;
+    size_t _capacity = 0;
+  };
+
+
+  uint64_t key_hash(uint64_t a, uint64_t b)
+  {
+    uint64_t x = a ^ (b * 0x9E3779B97F4A7C15ULL);
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+  }
+
+
+  // milestone payments, by the buyer or enforced by the arbiter
+  bool is_release(name status)
+  {
+    return status == name("milestone") || status == name("arbmilestone");
+  }
+
+  bool is_closing(name status)
+  {
+    return status == name("canceled") || status == name("closed") || status == name("expired") ||
+      status == name("arbrefund") || status == name("arbenforce");
+  }
+
+
+  class deal_index {
+  public:
+    explicit deal_index(const string& dir) : _dir(dir)
+    {
+      mkdir(dir.c_str(), 0755);
+      _meta.open(dir + "/meta.dat", 1);
+      _deals.open(dir + "/deals.dat", 1024);
+      _events.open(dir + "/events.dat", 4096);
+      _keys.open(dir + "/keys.dat", 4096);
+      meta_rec& m = _meta[0];
+      if( m.magic == 0 ) {
+        m.magic = INDEX_MAGIC;
+        m.version = INDEX_VERSION;
+      }
+      if( m.magic != INDEX_MAGIC || m.version != INDEX_VERSION ) {
+        fail(dir + " is not an escrowescrow index of version " + std::to_string(INDEX_VERSION));
+      }
+    }
+
+    ~deal_index()
+    {
+      _keys.sync();
+      _events.sync();
+      _deals.sync();
+      _meta.sync();
+    }
+
+    meta_rec& meta() { return _meta[0]; }
+
+    // -------------------------------------------------------------- ingestion
+
+    // Applies one trace; traces at or below the last applied sequence are skipped
+    bool apply(const escrow_trace::header& h, const vector<char>& data)
+    {
+      meta_rec& m = meta();
+      if( h.global_sequence <= m.last_global_sequence ) {
+        return false;
+      }
+      name act(h.action);
+      if( act == name("notify") ) {
+        on_notify(eosio::unpack<deal_notification_abi>(data), h);
+      }
+      else if( act == name("dealevent") ) {
+        on_event(eosio::unpack<deal_event_abi>(data), h);
+      }
+      else if( act == name("arbdeleted") ) {
+        auto a = eosio::unpack<arbdeleted_abi>(data);
+        key_rec& k = key(a.arbiter.value, KEY_ARBITER);
+        k.flags |= KEY_ARBITER_RETIRED;
+        add_event(a.arbiter.value, act, h, 0);
+      }
+      m.last_global_sequence = h.global_sequence;
+      return true;
+    }
+
+    // -------------------------------------------------------------- lookups
+
+    const deal_rec* find_deal(uint64_t id) const
+    {
+      const key_rec* k = find_key(id, KEY_ID);
+      return (k == nullptr || k->head == 0) ? nullptr : &_deals[k->head - 1];
+    }
+
+    // Deals of a list, newest first
+    template<typename F>
+    void for_each_in_list(uint64_t a, uint64_t b, list_kind kind, F&& f) const
+    {
+      const key_rec* k = find_key(a, b);
+      for( uint64_t i = k ? k->head : 0; i != 0; i = _deals[i - 1].next[kind] ) {
+        f(_deals[i - 1]);
+      }
+    }
+
+    template<typename F>
+    void for_each_key(F&& f) const
+    {
+      for( size_t i = 0; i < _keys.capacity(); i++ ) {
+        if( _keys[i].b != 0 ) f(_keys[i]);
+      }
+    }
+
+    // History of a deal, oldest first
+    vector<const event_rec*> history(const deal_rec& d) const
+    {
+      vector<const event_rec*> r;
+      for( uint64_t i = d.last_event; i != 0; i = _events[i - 1].prev ) {
+        r.push_back(&_events[i - 1]);
+      }
+      std::reverse(r.begin(), r.end());
+      return r;
+    }
+
+    // Deals and events are appended in time order, so time ranges are binary searches
+    std::pair<size_t, size_t> deals_created(uint64_t from_ms, uint64_t to_ms) const
+    {
+      return time_range(meta().deals, from_ms, to_ms, [&](size_t i) { return _deals[i].created_ms; });
+    }
+
+    std::pair<size_t, size_t> events_between(uint64_t from_ms, uint64_t to_ms) const
+    {
+      return time_range(meta().events, from_ms, to_ms, [&](size_t i) { return _events[i].time_ms; });
+    }
+
+    const deal_rec& deal_at(size_t i) const { return _deals[i]; }
+    const event_rec& event_at(size_t i) const { return _events[i]; }
+
+  private:
+    const meta_rec& meta() const { return _meta[0]; }
+
+    template<typename F>
+    static std::pair<size_t, size_t> time_range(size_t n, uint64_t from_ms, uint64_t to_ms, F&& time_of)
+    {
+      auto lower = [&](uint64_t t) {
+        size_t lo = 0, hi = n;
+        while( lo < hi ) {
+          size_t mid = (lo + hi) / 2;
+          if( time_of(mid) < t ) lo = mid + 1; else hi = mid;
+        }
+        return lo;
+      };
+      size_t first = lower(from_ms);
+      size_t last = (to_ms == UINT64_MAX) ? n : lower(to_ms + 1);
+      return {first, std::max(first, last)};
+    }
+
+    void on_notify(const deal_notification_abi& n, const escrow_trace::header& h)
+    {
+      deal_rec* d = nullptr;
+      if( n.deal_status != name("new") ) {
+        d = mutable_deal(n.deal_id);
+      }
+      if( d == nullptr ) {
+        // a new deal, or the first trace of a deal created before the dump started
+        d = &new_deal(n.deal_id, h.block_time_ms);
+        d->created_by = n.created_by.value;
+        d->buyer = n.buyer.value;
+        d->seller = n.seller.value;
+        d->arbiter = n.arbiter.value;
+        d->tkcontract = n.tkcontract.value;
+        d->symbol = n.quantity.symbol.raw();
+        d->amount = n.quantity.amount;
+        link(*d);
+      }
+      if( is_release(n.deal_status) ) {
+        // the notification carries the amount left in escrow
+        d->released = d->amount - n.quantity.amount;
+      }
+      d->days = n.days;
+      transition(*d, n.deal_status, h);
+    }
+
+    void on_event(const deal_event_abi& e, const escrow_trace::header& h)
+    {
+      deal_rec* d = mutable_deal(e.deal_id);
+      if( d == nullptr ) {
+        // compact events carry no parties; the deal cannot be indexed
+        meta().orphan_events++;
+        return;
+      }
+      if( is_release(e.deal_status) && e.remaining ) {
+        d->released = d->amount - e.remaining.value();
+      }
+      d->flags = e.flags;
+      d->days = e.days;
+      d->expires = e.expires.utc_seconds;
+      transition(*d, e.deal_status, h);
+    }
+
+    void transition(deal_rec& d, name status, const escrow_trace::header& h)
+    {
+      d.status = status.value;
+      d.updated_ms = h.block_time_ms;
+      if( status == name("funded") ) d.funded_ms = h.block_time_ms;
+      else if( status == name("delivered") ) d.delivered_ms = h.block_time_ms;
+      else if( status == name("arbitration") ) d.arbitration_ms = h.block_time_ms;
+      else if( is_closing(status) ) d.closed_ms = h.block_time_ms;
+      d.events++;
+      d.last_event = add_event(d.id, status, h, d.last_event);
+    }
+
+    uint64_t add_event(uint64_t subject, name status, const escrow_trace::header& h, uint64_t prev)
+    {
+      meta_rec& m = meta();
+      _events.reserve(m.events + 1);
+      _events[m.events] = event_rec{subject, status.value, h.block_time_ms, h.global_sequence, prev};
+      return ++m.events;
+    }
+
+    deal_rec* mutable_deal(uint64_t id)
+    {
+      key_rec* k = find_key(id, KEY_ID);
+      return (k == nullptr || k->head == 0) ? nullptr : &_deals[k->head - 1];
+    }
+
+    deal_rec& new_deal(uint64_t id, uint64_t time_ms)
+    {
+      meta_rec& m = meta();
+      _deals.reserve(m.deals + 1);
+      deal_rec& d = _deals[m.deals];
+      d = deal_rec{};
+      d.id = id;
+      d.created_ms = time_ms;
+      m.deals++;
+      key_rec& k = key(id, KEY_ID);
+      k.head = m.deals;
+      k.count++;
+      return d;
+    }
+
+    void link(deal_rec& d)
+    {
+      uint64_t self = &d - &_deals[0] + 1;
+      const std::pair<uint64_t, uint64_t> lists[LIST_KINDS] = {
+        {d.buyer, KEY_BUYER}, {d.seller, KEY_SELLER}, {d.arbiter, KEY_ARBITER}, {d.tkcontract, d.symbol} };
+      for( int kind = 0; kind < LIST_KINDS; kind++ ) {
+        key_rec& k = key(lists[kind].first, lists[kind].second);
+        d.next[kind] = k.head;
+        k.head = self;
+        k.count++;
+      }
+    }
+
+    const key_rec* find_key(uint64_t a, uint64_t b) const
+    {
+      size_t mask = _keys.capacity() - 1;
+      for( size_t i = key_hash(a, b) & mask; _keys[i].b != 0; i = (i + 1) & mask ) {
+        if( _keys[i].a == a && _keys[i].b == b ) return &_keys[i];
+      }
+      return nullptr;
+    }
+
+    key_rec* find_key(uint64_t a, uint64_t b)
+    {
+      return const_cast<key_rec*>(static_cast<const deal_index*>(this)->find_key(a, b));
+    }
+
+    // Returns the key record, inserting an empty one if needed
+    key_rec& key(uint64_t a, uint64_t b)
+    {
+      if( key_rec* k = find_key(a, b) ) return *k;
+      meta_rec& m = meta();
+      if( (m.keys_used + 1) * 10 > _keys.capacity() * 7 ) {
+        rehash(_keys.capacity() * 2);
+      }
+      size_t mask = _keys.capacity() - 1;
+      size_t i = key_hash(a, b) & mask;
+      while( _keys[i].b != 0 ) i = (i + 1) & mask;
+      _keys[i] = key_rec{a, b, 0, 0, 0};
+      m.keys_used++;
+      return _keys[i];
+    }
+
+    void rehash(size_t capacity)
+    {
+      string tmp = _dir + "/keys.dat.new";
+      unlink(tmp.c_str());
+      {
+        mapped_array<key_rec> grown;
+        grown.open(tmp, capacity);
+        size_t mask = capacity - 1;
+        for( size_t j = 0; j < _keys.capacity(); j++ ) {
+          if( _keys[j].b == 0 ) continue;
+          size_t i = key_hash(_keys[j].a, _keys[j].b) & mask;
+          while( grown[i].b != 0 ) i = (i + 1) & mask;
+          grown[i] = _keys[j];
+        }
+      }
+      string path = _keys.path();
+      _keys.close();
+      if( rename(tmp.c_str(), path.c_str()) != 0 ) fail("cannot replace " + path);
+      _keys.open(path, capacity);
+    }
+
+    string _dir;
+    mapped_array<meta_rec> _meta;
+    mapped_array<deal_rec> _deals;
+    mapped_array<event_rec> _events;
+    mapped_array<key_rec> _keys;
+  };
+
+
+  // -------------------------------------------------------------- commands
+
+  int ingest(deal_index& idx, const char* path, bool follow)
+  {
+    FILE* f = fopen(path, "rb");
+    if( f == nullptr ) fail(string("cannot open ") + path + ": " + strerror(errno));
+
+    // resume where the previous run stopped, unless the dump was replaced
+    meta_rec& m = idx.meta();
+    escrow_trace::header h;
+    vector<char> data;
+    if( m.dump_offset > 0 && fseek(f, m.dump_offset, SEEK_SET) == 0 ) {
+      long pos = ftell(f);
+      if( escrow_trace::read(f, h, data) && h.global_sequence <= m.last_global_sequence ) {
+        fseek(f, 0, SEEK_SET);
+      }
+      else {
+        fseek(f, pos, SEEK_SET);
+      }
+    }
+    else {
+      fseek(f, 0, SEEK_SET);
+    }
+
+    size_t applied = 0;
+    while( true ) {
+      long pos = ftell(f);
+      if( !escrow_trace::read(f, h, data) ) {
+        // end of the dump, or a record still being written
+        fseek(f, pos, SEEK_SET);
+        if( !follow ) break;
+        clearerr(f);
+        sleep(1);
+        continue;
+      }
+      if( idx.apply(h, data) ) applied++;
+      m.dump_offset = ftell(f);
+    }
+    fclose(f);
+    printf("applied %zu traces, index has %llu deals and %llu events, last global sequence %llu\n",
+           applied, (unsigned long long)m.deals, (unsigned long long)m.events,
+           (unsigned long long)m.last_global_sequence);
+    if( m.orphan_events > 0 ) {
+      printf("%llu compact events refer to deals that are not in the dump\n",
+             (unsigned long long)m.orphan_events);
+    }
+    return 0;
+  }
+
+
+  string token_string(const deal_rec& d)
+  {
+    return asset(d.amount, symbol(d.symbol)).to_string() + "@" + name(d.tkcontract).to_string();
+  }
+
+  void print_deal(const deal_rec& d)
+  {
+    printf("%llu %s buyer=%s seller=%s arbiter=%s price=%s created=%llu updated=%llu\n",
+           (unsigned long long)d.id, name(d.status).to_string().c_str(),
+           name(d.buyer).to_string().c_str(), name(d.seller).to_string().c_str(),
+           name(d.arbiter).to_string().c_str(), token_string(d).c_str(),
+           (unsigned long long)d.created_ms, (unsigned long long)d.updated_ms);
+  }
+
+
+  int show_deal(const deal_index& idx, uint64_t id)
+  {
+    const deal_rec* d = idx.find_deal(id);
+    if( d == nullptr ) {
+      fprintf(stderr, "deal %llu is not in the index\n", (unsigned long long)id);
+      return 1;
+    }
+    print_deal(*d);
+    printf("  created_by=%s days=%u flags=%u expires=%u\n", name(d->created_by).to_string().c_str(),
+           d->days, d->flags, d->expires);
+    for( const event_rec* e : idx.history(*d) ) {
+      printf("  %llu %s (global sequence %llu)\n", (unsigned long long)e->time_ms,
+             name(e->status).to_string().c_str(), (unsigned long long)e->global_sequence);
+    }
+    return 0;
+  }
+
+
+  int show_list(const deal_index& idx, uint64_t a, uint64_t b, list_kind kind)
+  {
+    size_t n = 0, open = 0;
+    idx.for_each_in_list(a, b, kind, [&](const deal_rec& d) {
+        print_deal(d);
+        n++;
+        if( d.closed_ms == 0 ) open++;
+      });
+    printf("%zu deals, %zu open\n", n, open);
+    return 0;
+  }
+
+
+  int show_created(const deal_index& idx, uint64_t from_ms, uint64_t to_ms)
+  {
+    auto r = idx.deals_created(from_ms, to_ms);
+    for( size_t i = r.first; i < r.second; i++ ) {
+      print_deal(idx.deal_at(i));
+    }
+    printf("%zu deals\n", r.second - r.first);
+    return 0;
+  }
+
+
+  int show_events(const deal_index& idx, uint64_t from_ms, uint64_t to_ms)
+  {
+    auto r = idx.events_between(from_ms, to_ms);
+    for( size_t i = r.first; i < r.second; i++ ) {
+      const event_rec& e = idx.event_at(i);
+      printf("%llu %llu %s\n", (unsigned long long)e.time_ms, (unsigned long long)e.subject,
+             name(e.status).to_string().c_str());
+    }
+    printf("%zu events\n", r.second - r.first);
+    return 0;
+  }
+
+
+  // Funded volume per token, and how much of it went to sellers or back to buyers
+  int show_volume(const deal_index& idx)
+  {
+    printf("%-28s %9s %9s %24s %24s %24s\n", "token", "deals", "funded", "funded volume",
+           "paid to sellers", "refunded");
+    idx.for_each_key([&](const key_rec& k) {
+        if( k.b < 256 ) return;
+        symbol sym(k.b);
+        size_t deals = 0, funded = 0;
+        int64_t volume = 0, paid = 0, refunded = 0;
+        idx.for_each_in_list(k.a, k.b, BY_TOKEN, [&](const deal_rec& d) {
+            deals++;
+            if( d.funded_ms == 0 ) return;
+            funded++;
+            volume += d.amount;
+            paid += d.released;
+            name status(d.status);
+            if( status == name("closed") || status == name("arbenforce") ) paid += d.amount - d.released;
+            else if( d.closed_ms != 0 ) refunded += d.amount - d.released;
+          });
+        printf("%-28s %9zu %9zu %24s %24s %24s\n", (sym.to_string() + "@" + name(k.a).to_string()).c_str(),
+               deals, funded, asset(volume, sym).to_string().c_str(), asset(paid, sym).to_string().c_str(),
+               asset(refunded, sym).to_string().c_str());
+      });
+    return 0;
+  }
+
+
+  // Disputes per arbiter and the time from arbitration to resolution
+  int show_arbstats(const deal_index& idx)
+  {
+    printf("%-13s %8s %8s %8s %8s %8s %14s %14s %14s %s\n", "arbiter", "deals", "open", "disputes",
+           "refunds", "enforced", "avg ms", "min ms", "max ms", "");
+    idx.for_each_key([&](const key_rec& k) {
+        if( k.b != KEY_ARBITER ) return;
+        size_t deals = 0, open = 0, disputes = 0, refunds = 0, enforced = 0;
+        uint64_t total_ms = 0, min_ms = UINT64_MAX, max_ms = 0;
+        idx.for_each_in_list(k.a, k.b, BY_ARBITER, [&](const deal_rec& d) {
+            deals++;
+            if( d.closed_ms == 0 ) open++;
+            if( d.arbitration_ms == 0 ) return;
+            // a milestone deal can go to arbitration once per milestone
+            uint64_t opened_ms = 0;
+            for( const event_rec* e : idx.history(d) ) {
+              name status(e->status);
+              if( status == name("arbitration") ) {
+                disputes++;
+                opened_ms = e->time_ms;
+                continue;
+              }
+              if( opened_ms == 0 ) continue;
+              if( status == name("arbrefund") || status == name("arbenforce") || status == name("arbmilestone") ) {
+                if( status == name("arbrefund") ) refunds++; else enforced++;
+                uint64_t ms = e->time_ms - opened_ms;
+                total_ms += ms;
+                min_ms = std::min(min_ms, ms);
+                max_ms = std::max(max_ms, ms);
+              }
+              opened_ms = 0;
+            }
+          });
+        size_t resolved = refunds + enforced;
+        printf("%-13s %8zu %8zu %8zu %8zu %8zu %14llu %14llu %14llu %s\n", name(k.a).to_string().c_str(),
+               deals, open, disputes, refunds, enforced,
+               (unsigned long long)(resolved ? total_ms / resolved : 0),
+               (unsigned long long)(resolved ? min_ms : 0), (unsigned long long)max_ms,
+               (k.flags & KEY_ARBITER_RETIRED) ? "retired" : "");
+      });
+    return 0;
+  }
+
+
+  symbol parse_symbol(const string& s)
+  {
+    auto comma = s.find(',');
+    if( comma == string::npos ) fail("symbol must be given as PRECISION,CODE");
+    return symbol(symbol_code(s.substr(comma + 1)), uint8_t(std::stoul(s.substr(0, comma))));
+  }
+
+  int usage(const char* prog)
+  {
+    fprintf(stderr,
+            "Usage: %s DIR ingest DUMP [--follow]\n"
+            "       %s DIR deal ID\n"
+            "       %s DIR buyer|seller|arbiter ACCOUNT\n"
+            "       %s DIR token CONTRACT PRECISION,SYMBOL\n"
+            "       %s DIR created|events FROM_MS TO_MS\n"
+            "       %s DIR volume|arbstats\n",
+            prog, prog, prog, prog, prog, prog);
+    return 1;
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  if( argc < 3 ) return usage(argv[0]);
+  string cmd = argv[2];
+  try {
+    deal_index idx(argv[1]);
+    if( cmd == "ingest" && (argc == 4 || (argc == 5 && strcmp(argv[4], "--follow") == 0)) ) {
+      return ingest(idx, argv[3], argc == 5);
+    }
+    if( cmd == "deal" && argc == 4 ) {
+      return show_deal(idx, strtoull(argv[3], nullptr, 10));
+    }
+    if( cmd == "buyer" && argc == 4 ) {
+      return show_list(idx, name(argv[3]).value, KEY_BUYER, BY_BUYER);
+    }
+    if( cmd == "seller" && argc == 4 ) {
+      return show_list(idx, name(argv[3]).value, KEY_SELLER, BY_SELLER);
+    }
+    if( cmd == "arbiter" && argc == 4 ) {
+      return show_list(idx, name(argv[3]).value, KEY_ARBITER, BY_ARBITER);
+    }
+    if( cmd == "token" && argc == 5 ) {
+      return show_list(idx, name(argv[3]).value, parse_symbol(argv[4]).raw(), BY_TOKEN);
+    }
+    if( cmd == "created" && argc == 5 ) {
+      return show_created(idx, strtoull(argv[3], nullptr, 10), strtoull(argv[4], nullptr, 10));
+    }
+    if( cmd == "events" && argc == 5 ) {
+      return show_events(idx, strtoull(argv[3], nullptr, 10), strtoull(argv[4], nullptr, 10));
+    }
+    if( cmd == "volume" && argc == 3 ) {
+      return show_volume(idx);
+    }
+    if( cmd == "arbstats" && argc == 3 ) {
+      return show_arbstats(idx);
+    }
+  }
+  catch( const std::exception& e ) {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return usage(argv[0]);
+}
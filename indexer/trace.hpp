@@ -0,0 +1,45 @@
+/*
+  Trace dump format read by escrow_indexer.
+
+  A dump is a plain sequence of records. Each record is a fixed 32-byte
+  little-endian header followed by the action data exactly as it appears
+  in the action trace of escrowescrow (`notify`, `dealevent` or
+  `arbdeleted`). Any trace source, such as a state history consumer or
+  the native benchmark with --trace, can append records to a dump while
+  the indexer reads it.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace escrow_trace {
+
+  struct header {
+    uint64_t global_sequence;  // strictly increasing across the whole dump
+    uint64_t block_time_ms;    // block timestamp, milliseconds since the epoch
+    uint64_t action;           // raw action name
+    uint32_t size;             // size of the action data that follows
+    uint32_t reserved;
+  };
+
+  static_assert(sizeof(header) == 32, "trace header must have no padding");
+
+  inline bool write(FILE* f, uint64_t global_sequence, uint64_t block_time_ms, uint64_t action,
+                    const std::vector<char>& data)
+  {
+    header h{global_sequence, block_time_ms, action, uint32_t(data.size()), 0};
+    return fwrite(&h, sizeof(h), 1, f) == 1 &&
+      (data.empty() || fwrite(data.data(), data.size(), 1, f) == 1);
+  }
+
+  // Reads the next record; false at the end of the dump or on a truncated record
+  inline bool read(FILE* f, header& h, std::vector<char>& data)
+  {
+    if( fread(&h, sizeof(h), 1, f) != 1 ) return false;
+    data.resize(h.size);
+    return h.size == 0 || fread(data.data(), h.size, 1, f) == 1;
+  }
+}
@@ -0,0 +1,1236 @@
+/*
+  Native cost benchmark for escrowescrow.
+
+  Compiles the contract against the in-memory chain in include/eosio and
+  runs scripted workloads over many deals, reporting per action the
+  database reads and writes, serialized row bytes, RAM delta, inline
+  actions, notifications, deferred transactions, heap allocations and
+  wall time.
+
+  Usage: escrowescrow_bench [--deals N] [--legacy-ids] [--compact] [--tokens MODE] [--trace FILE] [--workload NAME]...
+  Workloads: lifecycle, batch, bulkfund, settle, expiry, arbitration, query, directory,
+  templates, policy, prepaid, subscribed, receipts, milestones, migrate
+  (default: all of them)
+
+  --tokens registers the benchmark token and sets the token mode:
+  open (default), listed or strict.
+
+  --trace writes the notify, dealevent and arbdeleted traces of a single
+  workload to FILE in the format read by indexer/escrow_indexer.
+
+  Every workload checks its outcome, and after each of them the
+  dealevent sequences and funding times, the telemetry deal count, the
+  arbiter resolutions and the ledger are checked against the chain
+  state. The exit status is 1
+  if any check failed.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "escrowescrow.cpp"
+#include "token.hpp"
+#include "indexer/trace.hpp"
+
+// count heap allocations made by actions
+void* operator new(std::size_t size)
+{
+  eosio::native::heap_allocations++;
+  if( void* p = std::malloc(size ? size : 1) ) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+
+namespace {
+
+  using eosio::native::chain;
+  using eosio::native::action_cost;
+
+  const name ESCROW = name("escrowescrow");
+  const name TOKEN = name("simtoken");
+  const name KEEPER = name("keeper");
+  const symbol SYM = symbol("TKN", 4);
+  const int64_t PRICE = 10000;
+
+  const size_t NUM_BUYERS = 1000;
+  const size_t NUM_SELLERS = 100;
+  const size_t NUM_ARBITERS = 10;
+  const size_t BATCH_SIZE = 100;
+  const uint16_t ACCEPTED_FLAGS = 3; // buyer and seller accepted
+  const size_t FUND_BATCH_SIZE = 20;  // 10-digit IDs in a 256-byte token memo
+  const size_t ARB_BATCH_SIZE = 50;   // decisions per arbresolve call
+
+  const char* DESCRIPTION = "Simulated deal: 5 pumpkins, delivered to the door within the term";
+
+
+  // Deal state as seen from the notify and dealevent traces, like an
+  // off-chain observer would
+  struct observer {
+    std::map<uint64_t, name> live;
+    std::map<uint64_t, uint32_t> seqs;
+    std::map<uint64_t, time_point_sec> funded;
+    std::map<uint64_t, name> arbiters;
+    struct resolved {
+      uint32_t refunds = 0;
+      uint32_t enforcements = 0;
+    };
+    std::map<name, resolved> resolutions;   // by arbiter
+    vector<uint64_t> created;
+    size_t seq_gaps = 0;
+    size_t funded_moves = 0;
+
+    void on_notify(const escrowescrow::deal_notification_abi& n) {
+      if( n.deal_status == name("new") ) {
+        created.push_back(n.deal_id);
+        seqs[n.deal_id] = 0;
+      }
+      arbiters[n.deal_id] = n.arbiter;
+      update(n.deal_id, n.deal_status);
+    }
+
+    void on_event(const escrowescrow::deal_event_abi& e) {
+      if( e.seq != ++seqs[e.deal_id] ) {
+        seq_gaps++;
+        seqs[e.deal_id] = e.seq;
+      }
+      if( e.funded != time_point_sec() ) {
+        auto itr = funded.find(e.deal_id);
+        if( itr == funded.end() ) {
+          funded.emplace(e.deal_id, e.funded);
+        } else if( itr->second != e.funded ) {
+          funded_moves++;
+        }
+      }
+      update(e.deal_id, e.deal_status);
+    }
+
+    void update(uint64_t deal_id, name status) {
+      auto arb = arbiters.find(deal_id);
+      if( arb != arbiters.end() ) {
+        if( status == name("arbrefund") ) {
+          resolutions[arb->second].refunds++;
+        } else if( status == name("arbenforce") || status == name("arbmilestone") ) {
+          resolutions[arb->second].enforcements++;
+        }
+      }
+      static const std::vector<name> closing = {
+        name("canceled"), name("closed"), name("expired"), name("arbrefund"), name("arbenforce") };
+      for( auto c : closing ) {
+        if( status == c ) {
+          live.erase(deal_id);
+          seqs.erase(deal_id);
+          funded.erase(deal_id);
+          arbiters.erase(deal_id);
+          return;
+        }
+      }
+      live[deal_id] = status;
+    }
+
+    size_t count(name status) const {
+      size_t r = 0;
+      for( const auto& d : live ) {
+        if( d.second == status ) r++;
+      }
+      return r;
+    }
+  };
+
+  observer obs;
+  bool legacy_ids = false;
+  bool compact = false;
+  int token_mode = 0;
+  FILE* trace_file = nullptr;
+  size_t failed_checks = 0;
+
+
+  void expect(bool ok, const string& what)
+  {
+    if( !ok ) {
+      printf("  CHECK FAILED: %s\n", what.c_str());
+      failed_checks++;
+    }
+  }
+
+
+  void escrow_apply(name receiver, name code, name action)
+  {
+    if( code == receiver ) {
+      switch( action.value ) {
+      case name("setarbiter").value:  execute_action(receiver, code, &escrowescrow::setarbiter); break;
+      case name("delarbiter").value:  execute_action(receiver, code, &escrowescrow::delarbiter); break;
+      case name("newdeal").value:     execute_action(receiver, code, &escrowescrow::newdeal); break;
+      case name("newdeals").value:    execute_action(receiver, code, &escrowescrow::newdeals); break;
+      case name("newmsdeal").value:   execute_action(receiver, code, &escrowescrow::newmsdeal); break;
+      case name("newtemplate").value: execute_action(receiver, code, &escrowescrow::newtemplate); break;
+      case name("deltemplate").value: execute_action(receiver, code, &escrowescrow::deltemplate); break;
+      case name("newdealtpl").value:  execute_action(receiver, code, &escrowescrow::newdealtpl); break;
+      case name("setpolicy").value:   execute_action(receiver, code, &escrowescrow::setpolicy); break;
+      case name("delpolicy").value:   execute_action(receiver, code, &escrowescrow::delpolicy); break;
+      case name("subscribe").value:   execute_action(receiver, code, &escrowescrow::subscribe); break;
+      case name("legacyids").value:   execute_action(receiver, code, &escrowescrow::legacyids); break;
+      case name("settoken").value:    execute_action(receiver, code, &escrowescrow::settoken); break;
+      case name("deltoken").value:    execute_action(receiver, code, &escrowescrow::deltoken); break;
+      case name("tokenmode").value:   execute_action(receiver, code, &escrowescrow::tokenmode); break;
+      case name("notifymode").value:  execute_action(receiver, code, &escrowescrow::notifymode); break;
+      case name("accept").value:      execute_action(receiver, code, &escrowescrow::accept); break;
+      case name("cancel").value:      execute_action(receiver, code, &escrowescrow::cancel); break;
+      case name("delivered").value:   execute_action(receiver, code, &escrowescrow::delivered); break;
+      case name("goodsrcvd").value:   execute_action(receiver, code, &escrowescrow::goodsrcvd); break;
+      case name("goodsrcvds").value:  execute_action(receiver, code, &escrowescrow::goodsrcvds); break;
+      case name("cancels").value:     execute_action(receiver, code, &escrowescrow::cancels); break;
+      case name("extend").value:      execute_action(receiver, code, &escrowescrow::extend); break;
+      case name("arbrefund").value:   execute_action(receiver, code, &escrowescrow::arbrefund); break;
+      case name("arbenforce").value:  execute_action(receiver, code, &escrowescrow::arbenforce); break;
+      case name("arbresolve").value:  execute_action(receiver, code, &escrowescrow::arbresolve); break;
+      case name("wipeexpired").value: execute_action(receiver, code, &escrowescrow::wipeexpired); break;
+      case name("arbdeleted").value:  execute_action(receiver, code, &escrowescrow::arbdeleted); break;
+      case name("setsweep").value:    execute_action(receiver, code, &escrowescrow::setsweep); break;
+      case name("getdeals").value:    execute_action(receiver, code, &escrowescrow::getdeals); break;
+      case name("getarbiters").value: execute_action(receiver, code, &escrowescrow::getarbiters); break;
+      case name("gettelemetry").value: execute_action(receiver, code, &escrowescrow::gettelemetry); break;
+      case name("reconcile").value:   execute_action(receiver, code, &escrowescrow::reconcile); break;
+      case name("verifyrcpt").value:  execute_action(receiver, code, &escrowescrow::verifyrcpt); break;
+      case name("migrate").value:     execute_action(receiver, code, &escrowescrow::migrate); break;
+      case name("fillarbstats").value: execute_action(receiver, code, &escrowescrow::fillarbstats); break;
+      case name("notify").value:
+        obs.on_notify(eosio::unpack_action_data<escrowescrow::deal_notification_abi>());
+        execute_action(receiver, code, &escrowescrow::notify);
+        break;
+      case name("dealevent").value:
+        obs.on_event(eosio::unpack_action_data<escrowescrow::deal_event_abi>());
+        execute_action(receiver, code, &escrowescrow::dealevent);
+        break;
+      default:
+        check(false, "unknown action");
+      }
+    }
+    else if( action == name("transfer") ) {
+      execute_action(receiver, code, &escrowescrow::transfer_handler);
+    }
+  }
+
+
+  name account_name(const char* prefix, size_t i)
+  {
+    static const char* digits = "12345abcdefghijklmnopqrstuvwxyz";
+    string s(prefix);
+    string suffix;
+    do {
+      suffix += digits[i % 31];
+      i /= 31;
+    } while( i > 0 );
+    while( s.size() + suffix.size() < 12 ) suffix += '1';
+    return name(s + suffix);
+  }
+
+  name buyer(size_t i)   { return account_name("buyer", i % NUM_BUYERS); }
+  name seller(size_t i)  { return account_name("seller", i % NUM_SELLERS); }
+  name arbiter(size_t i) { return account_name("arbitr", i % NUM_ARBITERS); }
+
+
+  void setup()
+  {
+    auto& c = chain::instance();
+    c.reset_state();
+    obs = observer();
+    c.set_code(ESCROW, escrow_apply);
+    c.set_code(TOKEN, simtoken::apply);
+    c.create_account(KEEPER);
+    if( trace_file ) {
+      c.set_trace_handler([](uint64_t global_sequence, eosio::time_point block_time,
+                             const eosio::native::packed_action& act) {
+          if( act.account == ESCROW &&
+              (act.action == name("notify") || act.action == name("dealevent") || act.action == name("arbdeleted")) ) {
+            escrow_trace::write(trace_file, global_sequence, block_time.time_since_epoch().count() / 1000,
+                                act.action.value, act.data);
+          }
+        });
+    }
+    if( legacy_ids ) {
+      c.push_action(ESCROW, name("legacyids"), ESCROW, true);
+    }
+    if( compact ) {
+      c.push_action(ESCROW, name("notifymode"), ESCROW, true);
+    }
+    if( token_mode > 0 ) {
+      c.push_action(ESCROW, name("settoken"), ESCROW, TOKEN, SYM, int64_t(0), int64_t(0));
+      c.push_action(ESCROW, name("tokenmode"), ESCROW, uint8_t(token_mode));
+    }
+    for( size_t i = 0; i < NUM_BUYERS; i++ ) {
+      c.create_account(buyer(i));
+      c.push_action(TOKEN, name("issue"), TOKEN, buyer(i), asset(PRICE * 1000000, SYM));
+    }
+    for( size_t i = 0; i < NUM_SELLERS; i++ ) {
+      c.create_account(seller(i));
+    }
+    for( size_t i = 0; i < NUM_ARBITERS; i++ ) {
+      c.create_account(arbiter(i));
+      c.push_action(ESCROW, name("setarbiter"), arbiter(i), arbiter(i), string("Arbiter"),
+                    string("arbiter@example.com"), string("Resolves disputes in simulated deals"),
+                    string("https://example.com"), string("+10000000000"), string("US"));
+    }
+    c.reset_stats();
+  }
+
+
+  // failed actions so far with the given error message
+  uint64_t failures(const char* error)
+  {
+    auto& errors = chain::instance().errors();
+    auto itr = errors.find(error);
+    return itr == errors.end() ? 0 : itr->second;
+  }
+
+
+  // Creates a deal by the buyer and returns its ID, or 0 if creation failed
+  uint64_t open_deal(size_t i, uint32_t days)
+  {
+    obs.created.clear();
+    bool ok = chain::instance().push_action(ESCROW, name("newdeal"), buyer(i), buyer(i), string(DESCRIPTION),
+                                            TOKEN, asset(PRICE, SYM), buyer(i), seller(i), arbiter(i), days);
+    return (ok && obs.created.size() == 1) ? obs.created[0] : 0;
+  }
+
+  bool accept_deal(size_t i, uint64_t id)
+  {
+    return chain::instance().push_action(ESCROW, name("accept"), seller(i), seller(i), id);
+  }
+
+  bool fund_deal(size_t i, uint64_t id)
+  {
+    return chain::instance().push_action(TOKEN, name("transfer"), buyer(i), buyer(i), ESCROW,
+                                         asset(PRICE, SYM), to_string(id));
+  }
+
+  bool deliver_deal(size_t i, uint64_t id)
+  {
+    return chain::instance().push_action(ESCROW, name("delivered"), seller(i), id,
+                                         string("Shipped, tracking number 34r8934r243"));
+  }
+
+
+  struct deal_ref {
+    size_t   i;
+    uint64_t id;
+  };
+
+  // Opens n deals and drives each of them through the first `stage` steps:
+  // 1 = created, 2 = accepted, 3 = funded, 4 = delivered
+  std::vector<deal_ref> open_deals(size_t n, int stage, uint32_t days)
+  {
+    auto& c = chain::instance();
+    std::vector<deal_ref> deals;
+    deals.reserve(n);
+    for( size_t i = 0; i < n; i++ ) {
+      uint64_t id = open_deal(i, days);
+      if( id ) deals.push_back({i, id});
+    }
+    c.advance(eosio::seconds(60));
+    std::vector<deal_ref> next;
+    if( stage >= 2 ) {
+      for( auto& d : deals ) if( accept_deal(d.i, d.id) ) next.push_back(d);
+      deals.swap(next); next.clear();
+      c.advance(eosio::seconds(60));
+    }
+    if( stage >= 3 ) {
+      for( auto& d : deals ) if( fund_deal(d.i, d.id) ) next.push_back(d);
+      deals.swap(next); next.clear();
+      c.advance(eosio::seconds(60));
+    }
+    if( stage >= 4 ) {
+      for( auto& d : deals ) if( deliver_deal(d.i, d.id) ) next.push_back(d);
+      deals.swap(next); next.clear();
+      c.advance(eosio::seconds(60));
+    }
+    return deals;
+  }
+
+
+  // newdeal -> accept -> transfer -> delivered -> goodsrcvd over the whole set
+  void workload_lifecycle(size_t n)
+  {
+    auto& c = chain::instance();
+    auto deals = open_deals(n, 4, 30);
+    expect(deals.size() == n, "every deal is delivered");
+    if( !deals.empty() ) {
+      const uint64_t before = failures("Deal can only be accepted by either seller or buyer");
+      c.push_action(ESCROW, name("accept"), KEEPER, KEEPER, deals[0].id);
+      expect(failures("Deal can only be accepted by either seller or buyer") == before + 1,
+             "accept by a third party reports the party error");
+      const uint64_t refunds = failures("The deal is not open for arbitration");
+      c.push_action(ESCROW, name("arbrefund"), KEEPER, deals[0].id);
+      expect(failures("The deal is not open for arbitration") == refunds + 1,
+             "arbrefund outside arbitration reports that before the authority");
+    }
+    size_t closed = 0;
+    for( auto& d : deals ) {
+      if( c.push_action(ESCROW, name("goodsrcvd"), buyer(d.i), d.id) ) closed++;
+    }
+    c.run_deferred();
+    expect(closed == deals.size(), "every delivered deal is closed");
+  }
+
+
+  // Sellers list deals for many buyers through newdeals, BATCH_SIZE per action
+  void workload_batch(size_t n)
+  {
+    auto& c = chain::instance();
+    size_t created = 0;
+    for( size_t first = 0; first < n; first += BATCH_SIZE ) {
+      size_t s = first / BATCH_SIZE;
+      vector<escrowescrow::dealspec> specs;
+      for( size_t i = first; i < n && i < first + BATCH_SIZE; i++ ) {
+        specs.push_back({DESCRIPTION, TOKEN, asset(PRICE, SYM), buyer(i), seller(s), arbiter(s), 30});
+      }
+      obs.created.clear();
+      if( c.push_action(ESCROW, name("newdeals"), seller(s), seller(s), specs) ) {
+        created += obs.created.size();
+      }
+    }
+    expect(created == n, "every deal is created");
+    auto itr = c.stats().find("escrowescrow::newdeals");
+    if( itr != c.stats().end() && created > 0 ) {
+      const action_cost& a = itr->second;
+      printf("  per deal: %.2f reads, %.2f writes, %.2f us\n",
+             double(a.db_reads) / created, double(a.db_writes) / created, a.wall_ns / 1000.0 / created);
+    }
+  }
+
+
+  // Buyers open BATCH_SIZE deals each through newdeals, sellers accept
+  // them, and buyers pay for FUND_BATCH_SIZE deals with one transfer
+  void workload_bulkfund(size_t n)
+  {
+    auto& c = chain::instance();
+    size_t funded = 0;
+    for( size_t first = 0; first < n; first += BATCH_SIZE ) {
+      size_t b = first / BATCH_SIZE;
+      vector<escrowescrow::dealspec> specs;
+      for( size_t i = first; i < n && i < first + BATCH_SIZE; i++ ) {
+        specs.push_back({DESCRIPTION, TOKEN, asset(PRICE, SYM), buyer(b), seller(i), arbiter(i), 30});
+      }
+      obs.created.clear();
+      if( !c.push_action(ESCROW, name("newdeals"), buyer(b), buyer(b), specs) ) continue;
+      vector<uint64_t> ids = obs.created;
+      string memo;
+      size_t count = 0;
+      for( size_t k = 0; k < ids.size(); k++ ) {
+        if( accept_deal(first + k, ids[k]) ) {
+          if( !memo.empty() ) memo += ',';
+          memo += to_string(ids[k]);
+          count++;
+        }
+        if( count > 0 && (count == FUND_BATCH_SIZE || k + 1 == ids.size()) ) {
+          if( c.push_action(TOKEN, name("transfer"), buyer(b), buyer(b), ESCROW,
+                            asset(PRICE * count, SYM), memo) ) {
+            funded += count;
+          }
+          memo.clear();
+          count = 0;
+        }
+      }
+    }
+    expect(funded == n, "every deal is funded");
+    auto itr = c.stats().find("escrowescrow::transfer");
+    if( itr != c.stats().end() && funded > 0 ) {
+      const action_cost& a = itr->second;
+      printf("  funded %zu deals, per deal: %.2f reads, %.2f writes, %.2f us\n", funded,
+             double(a.db_reads) / funded, double(a.db_writes) / funded, a.wall_ns / 1000.0 / funded);
+    }
+  }
+
+
+  // Funded deals settled in batches: buyers sign off goods received for
+  // all their deals at once, and sellers cancel theirs with refunds
+  void workload_settle(size_t n)
+  {
+    auto& c = chain::instance();
+    std::vector<deal_ref> deals = open_deals(n, 3, 30);
+    std::map<name, vector<uint64_t>> received;
+    std::map<name, vector<uint64_t>> canceled;
+    for( auto& d : deals ) {
+      if( d.i % 2 == 0 ) received[buyer(d.i)].push_back(d.id);
+      else canceled[seller(d.i)].push_back(d.id);
+    }
+    c.reset_stats();
+    size_t settled = 0;
+    for( auto& r : received ) {
+      if( c.push_action(ESCROW, name("goodsrcvds"), r.first, r.second) ) settled += r.second.size();
+    }
+    for( auto& r : canceled ) {
+      if( c.push_action(ESCROW, name("cancels"), r.first, r.second) ) settled += r.second.size();
+    }
+    expect(deals.size() == n && settled == n, "every deal is funded and settled");
+    auto itr = c.stats().find("simtoken::transfer");
+    printf("  settled %zu deals with %llu token transfers\n", settled,
+           itr == c.stats().end() ? 0ULL : (unsigned long long)itr->second.calls);
+  }
+
+
+  // A backlog of expired deals in every state, drained by the expiry sweep
+  // that runs within regular traffic
+  void workload_expiry(size_t n)
+  {
+    auto& c = chain::instance();
+    open_deals(n / 3, 1, 1);
+    open_deals(n / 3, 2, 1);
+    open_deals(n - 2*(n / 3), 3, 1);
+    c.advance(eosio::days(4));
+
+    size_t backlog = obs.live.size();
+    size_t traffic = 0;
+    size_t rounds = 0;
+    const size_t per_round = 100;
+    while( obs.live.size() > traffic && rounds < 100000 ) {
+      for( size_t k = 0; k < per_round; k++ ) {
+        if( open_deal(n + traffic, 30) ) traffic++;
+      }
+      c.advance(eosio::seconds(10));
+      rounds++;
+    }
+    printf("  expired backlog: %zu deals, drained after %zu rounds of %zu actions (%zu left)\n",
+           backlog, rounds, per_round, obs.live.size() - traffic);
+    expect(backlog == n && obs.live.size() == traffic, "the expired backlog is drained");
+  }
+
+
+  // Delivered deals whose buyer never confirms go to arbitration through a
+  // keeper calling wipeexpired; arbiters then resolve them. One arbiter
+  // retires halfway and gets removed when its last deal is closed.
+  void workload_arbitration(size_t n)
+  {
+    auto& c = chain::instance();
+    auto deals = open_deals(n, 4, 30);
+    c.advance(eosio::seconds(DELIVERED_DEAL_EXPIRES + 1));
+
+    size_t calls = 0;
+    while( c.push_action(ESCROW, name("wipeexpired"), KEEPER, uint16_t(100)) ) {
+      calls++;
+    }
+    printf("  %zu deals in arbitration after %zu wipeexpired calls\n", obs.count(name("arbitration")), calls);
+    expect(deals.size() == n && obs.count(name("arbitration")) == n, "every delivered deal goes to arbitration");
+    if( !deals.empty() ) {
+      // a deal in arbitration reports that rather than its zero expiration time
+      const uint64_t before = failures("The deal is in arbitration");
+      c.push_action(ESCROW, name("cancel"), seller(deals[0].i), deals[0].id);
+      expect(failures("The deal is in arbitration") == before + 1, "cancel reports arbitration");
+    }
+
+    // the first half of arbiters resolve one deal per action, the rest
+    // send their queues in arbresolve batches
+    c.push_action(ESCROW, name("delarbiter"), arbiter(0), arbiter(0));
+    c.advance(eosio::hours(2));
+    std::map<name, vector<escrowescrow::arbdecision>> queues;
+    for( auto& d : deals ) {
+      name act = (d.id & 1) ? name("arbrefund") : name("arbenforce");
+      if( d.i % NUM_ARBITERS < NUM_ARBITERS / 2 ) {
+        c.push_action(ESCROW, act, arbiter(d.i), d.id);
+        continue;
+      }
+      auto& queue = queues[arbiter(d.i)];
+      queue.push_back({d.id, act});
+      if( queue.size() == ARB_BATCH_SIZE ) {
+        c.push_action(ESCROW, name("arbresolve"), arbiter(d.i), arbiter(d.i), queue);
+        queue.clear();
+      }
+    }
+    for( auto& q : queues ) {
+      if( !q.second.empty() ) {
+        c.push_action(ESCROW, name("arbresolve"), q.first, q.first, q.second);
+      }
+    }
+    expect(obs.live.empty(), "every dispute is resolved");
+    expect(c.row_count(ESCROW, name("arbiters")) == NUM_ARBITERS - 1, "the retired arbiter is removed");
+  }
+
+
+  // Every seller registers one template and lists its deals from it;
+  // the deals then run the full lifecycle, which frees the templates
+  void workload_templates(size_t n)
+  {
+    auto& c = chain::instance();
+    std::map<name, uint64_t> templates;
+    for( size_t s = 0; s < NUM_SELLERS && s < n; s++ ) {
+      if( c.push_action(ESCROW, name("newtemplate"), seller(s), seller(s), string(DESCRIPTION),
+                        TOKEN, SYM, uint32_t(30), arbiter(s)) ) {
+        templates[seller(s)] = eosio::unpack<uint64_t>(eosio::native::action_return_value());
+      }
+    }
+    std::vector<deal_ref> deals;
+    for( size_t i = 0; i < n; i++ ) {
+      obs.created.clear();
+      if( c.push_action(ESCROW, name("newdealtpl"), seller(i), seller(i), templates[seller(i)],
+                        asset(PRICE, SYM), buyer(i), seller(i), uint32_t(0)) &&
+          obs.created.size() == 1 ) {
+        deals.push_back({i, obs.created[0]});
+      }
+    }
+    size_t peak = c.row_count(ESCROW, name("templates"));
+    c.advance(eosio::seconds(60));
+    for( auto& d : deals ) {
+      c.push_action(ESCROW, name("accept"), buyer(d.i), buyer(d.i), d.id);
+    }
+    c.advance(eosio::seconds(60));
+    for( auto& d : deals ) {
+      fund_deal(d.i, d.id);
+    }
+    for( auto& d : deals ) {
+      deliver_deal(d.i, d.id);
+    }
+    for( auto& d : deals ) {
+      c.push_action(ESCROW, name("goodsrcvd"), buyer(d.i), d.id);
+    }
+    printf("  %zu deals from %zu templates, %zu templates left after closing\n", deals.size(), peak,
+           c.row_count(ESCROW, name("templates")));
+    expect(deals.size() == n && obs.live.empty(), "every template deal is closed");
+    expect(c.row_count(ESCROW, name("templates")) == 0, "the last deal of a template frees it");
+  }
+
+
+  // Sellers accept deals up to 10 times the base price through a standing
+  // policy, so buyers fund their deals without waiting for accept; deals
+  // above the limit still need it
+  void workload_policy(size_t n)
+  {
+    auto& c = chain::instance();
+    vector<escrowescrow::policytoken> tokens = {{TOKEN, SYM, 0, PRICE * 10}};
+    for( size_t s = 0; s < NUM_SELLERS; s++ ) {
+      c.push_action(ESCROW, name("setpolicy"), seller(s), seller(s), tokens, vector<name>(), uint32_t(60));
+    }
+    std::vector<deal_ref> deals;
+    size_t accepts = 0;
+    for( size_t i = 0; i < n; i++ ) {
+      obs.created.clear();
+      const int64_t price = (i % 10 == 0) ? PRICE * 20 : PRICE;
+      if( !c.push_action(ESCROW, name("newdeal"), buyer(i), buyer(i), string(DESCRIPTION),
+                         TOKEN, asset(price, SYM), buyer(i), seller(i), arbiter(i), uint32_t(30)) ||
+          obs.created.size() != 1 ) {
+        continue;
+      }
+      uint64_t id = obs.created[0];
+      if( obs.live[id] != name("accepted") ) {
+        if( !accept_deal(i, id) ) continue;
+        accepts++;
+      }
+      if( c.push_action(TOKEN, name("transfer"), buyer(i), buyer(i), ESCROW, asset(price, SYM), to_string(id)) ) {
+        deals.push_back({i, id});
+      }
+    }
+    for( auto& d : deals ) {
+      deliver_deal(d.i, d.id);
+    }
+    for( auto& d : deals ) {
+      c.push_action(ESCROW, name("goodsrcvd"), buyer(d.i), d.id);
+    }
+    printf("  %zu deals funded, %zu of them needed an accept transaction\n", deals.size(), accepts);
+    expect(deals.size() == n && accepts == (n + 9) / 10, "only deals above the policy limit need accept");
+    expect(obs.live.empty(), "every policy deal is closed");
+  }
+
+
+  // Buyers create and fund deals with one transfer, half of them from a
+  // template; sellers accept all but every tenth deal, which is refunded
+  // when the acceptance deadline passes. The token is registered with a
+  // minimum deal amount, which deals by transfer need.
+  void workload_prepaid(size_t n)
+  {
+    auto& c = chain::instance();
+    const string probe = "deal:" + seller(0).to_string() + ":" + arbiter(0).to_string() + ":30:5 pumpkins";
+    if( token_mode == 0 ) {
+      expect(!c.push_action(TOKEN, name("transfer"), buyer(0), buyer(0), ESCROW, asset(PRICE, SYM), probe),
+             "deals by transfer are rejected in open token mode");
+      c.push_action(ESCROW, name("tokenmode"), ESCROW, uint8_t(1));
+    }
+    c.push_action(ESCROW, name("settoken"), ESCROW, TOKEN, SYM, int64_t(0), int64_t(0));
+    expect(!c.push_action(TOKEN, name("transfer"), buyer(0), buyer(0), ESCROW, asset(PRICE, SYM), probe),
+           "deals by transfer are rejected without a minimum deal amount");
+    c.push_action(ESCROW, name("settoken"), ESCROW, TOKEN, SYM, PRICE / 10, int64_t(0));
+    c.reset_stats();
+    std::map<name, uint64_t> templates;
+    for( size_t s = 0; s < NUM_SELLERS && s < n; s++ ) {
+      if( c.push_action(ESCROW, name("newtemplate"), seller(s), seller(s), string(DESCRIPTION),
+                        TOKEN, SYM, uint32_t(30), arbiter(s)) ) {
+        templates[seller(s)] = eosio::unpack<uint64_t>(eosio::native::action_return_value());
+      }
+    }
+    std::vector<deal_ref> deals;
+    for( size_t i = 0; i < n; i++ ) {
+      string memo = (i % 2 == 0) ?
+        "deal:" + seller(i).to_string() + ":" + arbiter(i).to_string() + ":30:5 pumpkins" :
+        "tpl:" + to_string(templates[seller(i)]) + ":" + seller(i).to_string() + ":0";
+      obs.created.clear();
+      if( c.push_action(TOKEN, name("transfer"), buyer(i), buyer(i), ESCROW, asset(PRICE, SYM), memo) &&
+          obs.created.size() == 1 ) {
+        deals.push_back({i, obs.created[0]});
+      }
+    }
+    c.advance(eosio::seconds(60));
+    std::vector<deal_ref> accepted;
+    for( auto& d : deals ) {
+      if( d.i % 10 != 9 && accept_deal(d.i, d.id) ) accepted.push_back(d);
+    }
+    for( auto& d : accepted ) {
+      deliver_deal(d.i, d.id);
+    }
+    for( auto& d : accepted ) {
+      c.push_action(ESCROW, name("goodsrcvd"), buyer(d.i), d.id);
+    }
+    c.advance(eosio::days(4));
+    while( c.push_action(ESCROW, name("wipeexpired"), KEEPER, uint16_t(100)) ) {}
+    printf("  %zu deals created by transfer, %zu accepted and closed, %zu refunded on timeout\n",
+           deals.size(), accepted.size(), deals.size() - accepted.size());
+    expect(deals.size() == n && accepted.size() == n - n / 10, "every prepaid deal is created");
+    expect(obs.live.empty(), "unaccepted prepaid deals are refunded");
+  }
+
+
+  // The lifecycle workload with arbiters subscribed to disputes only and
+  // sellers to new and funded deals only
+  void workload_subscribed(size_t n)
+  {
+    auto& c = chain::instance();
+    for( size_t a = 0; a < NUM_ARBITERS; a++ ) {
+      c.push_action(ESCROW, name("subscribe"), arbiter(a), arbiter(a),
+                    uint8_t(EVENTS_ARBITRATION | EVENTS_CLOSED));
+    }
+    for( size_t s = 0; s < NUM_SELLERS; s++ ) {
+      c.push_action(ESCROW, name("subscribe"), seller(s), seller(s), uint8_t(EVENTS_NEW | EVENTS_FUNDED));
+    }
+    c.reset_stats();
+    workload_lifecycle(n);
+    expect(obs.live.empty(), "every deal is closed");
+  }
+
+
+  // Deals closed within one checkpoint period, with the receipts kept by
+  // an auditor; some are verified against the checkpoint, with one forged
+  void workload_receipts(size_t n)
+  {
+    auto& c = chain::instance();
+    vector<escrowescrow::closing_receipt> receipts;
+    for( size_t i = 0; i < n; i++ ) {
+      uint64_t id = open_deal(i, 30);
+      if( !id || !accept_deal(i, id) || !fund_deal(i, id) ) continue;
+      const time_point_sec funded(c.now());
+      if( !deliver_deal(i, id) || !c.push_action(ESCROW, name("goodsrcvd"), buyer(i), id) ) continue;
+      receipts.push_back({id, buyer(i), seller(i), arbiter(i), extended_asset(asset(PRICE, SYM), TOKEN),
+                          name("closed"), funded, time_point_sec(c.now())});
+    }
+    if( receipts.empty() ) return;
+
+    // the checkpoint of each receipt, by the rule of the contract: a new
+    // one when the period changes or the last one is full
+    vector<eosio::checksum256> digests;
+    vector<uint64_t> checkpoint_of;
+    vector<size_t> first_of;   // index of the first receipt of each checkpoint
+    uint64_t period = 0;
+    for( size_t k = 0; k < receipts.size(); k++ ) {
+      const uint64_t p = receipts[k].closed.utc_seconds / CHECKPOINT_PERIOD_SEC;
+      if( k == 0 || p != period || k - first_of.back() == CHECKPOINT_MAX_RECEIPTS ) {
+        first_of.push_back(k);
+        period = p;
+      }
+      checkpoint_of.push_back(first_of.size() - 1);
+      digests.push_back(escrowescrow::_receipt_digest(receipts[k]));
+    }
+    c.reset_stats();
+    size_t verified = 0, checked = 0;
+    auto verify = [&]( size_t k, const escrowescrow::closing_receipt& r ) {
+      const uint64_t cp = checkpoint_of[k];
+      const size_t end = (cp + 1 < first_of.size()) ? first_of[cp + 1] : receipts.size();
+      vector<eosio::checksum256> before(digests.begin() + first_of[cp], digests.begin() + k);
+      vector<eosio::checksum256> after(digests.begin() + k + 1, digests.begin() + end);
+      checked++;
+      if( c.push_action(ESCROW, name("verifyrcpt"), KEEPER, cp, before, r, after) &&
+          eosio::unpack<bool>(eosio::native::action_return_value()) ) {
+        verified++;
+      }
+    };
+    for( size_t k = 0; k < receipts.size(); k += std::max<size_t>(1, receipts.size() / 10) ) {
+      verify(k, receipts[k]);
+    }
+    expect(verified == checked, "every genuine receipt verifies");
+    auto forged = receipts[0];
+    forged.outcome = name("arbrefund");
+    const size_t genuine = verified;
+    verify(0, forged);
+    expect(verified == genuine, "the forged receipt is rejected");
+    printf("  %zu receipts in %zu checkpoints, %zu of %zu verified (the last one forged)\n", receipts.size(),
+           c.row_count(ESCROW, name("checkpoints")), verified, checked);
+  }
+
+
+  // Buyers open deals of MILESTONES equal tranches and fund the total;
+  // each milestone is delivered and signed off. Every tenth buyer leaves
+  // the second milestone unconfirmed, and the arbiter enforces it.
+  void workload_milestones(size_t n)
+  {
+    auto& c = chain::instance();
+    const size_t MILESTONES = 4;
+    vector<escrowescrow::milestone> milestones(MILESTONES, {asset(PRICE / MILESTONES, SYM), 30});
+    std::vector<deal_ref> deals;
+    for( size_t i = 0; i < n; i++ ) {
+      obs.created.clear();
+      if( c.push_action(ESCROW, name("newmsdeal"), buyer(i), buyer(i), string(DESCRIPTION), TOKEN,
+                        buyer(i), seller(i), arbiter(i), milestones) && obs.created.size() == 1 &&
+          accept_deal(i, obs.created[0]) && fund_deal(i, obs.created[0]) ) {
+        deals.push_back({i, obs.created[0]});
+      }
+    }
+    c.advance(eosio::seconds(60));
+    const size_t created = deals.size();
+    size_t released = 0, closed = 0, refunded = 0;
+    for( size_t m = 0; m < MILESTONES; m++ ) {
+      size_t& paid = (m + 1 < MILESTONES) ? released : closed;
+      for( auto& d : deals ) {
+        deliver_deal(d.i, d.id);
+      }
+      for( auto& d : deals ) {
+        if( (m != 1 || d.i % 10 != 9) && c.push_action(ESCROW, name("goodsrcvd"), buyer(d.i), d.id) ) {
+          paid++;
+        }
+      }
+      if( m == 1 ) {
+        // the arbiter refunds the rest of every twentieth deal
+        c.advance(eosio::seconds(DELIVERED_DEAL_EXPIRES + 1));
+        while( c.push_action(ESCROW, name("wipeexpired"), KEEPER, uint16_t(100)) ) {}
+        std::vector<deal_ref> live;
+        for( auto& d : deals ) {
+          if( d.i % 20 == 19 ) {
+            if( c.push_action(ESCROW, name("arbrefund"), arbiter(d.i), d.id) ) refunded++;
+            continue;
+          }
+          if( d.i % 10 == 9 && c.push_action(ESCROW, name("arbenforce"), arbiter(d.i), d.id) ) paid++;
+          live.push_back(d);
+        }
+        deals.swap(live);
+      }
+      c.advance(eosio::seconds(60));
+    }
+    printf("  %zu deals of %zu milestones, %zu milestones released, %zu deals closed, %zu refunded\n",
+           created, MILESTONES, released, closed, refunded);
+    expect(created == n && refunded == n / 20 && closed == n - refunded &&
+           released == n * (MILESTONES - 1) - refunded * (MILESTONES - 2),
+           "every milestone is released or refunded and every deal closed");
+  }
+
+
+  // Tables of the contract version before the upgrade, written by the
+  // old code installed on the escrow account for the migrate workload
+  struct old_deal {
+    uint64_t       id;
+    name           created_by;
+    string         description;
+    extended_asset price;
+    name           buyer;
+    name           seller;
+    name           arbiter;
+    uint32_t       days;
+    time_point_sec funded;
+    time_point_sec expires;
+    uint16_t       flags;
+    string         delivery_memo;
+    auto primary_key()const { return id; }
+    uint64_t get_expires()const { return expires.utc_seconds; }
+    uint64_t get_arbiter()const { return arbiter.value; }
+  };
+
+  typedef eosio::multi_index<
+    name("deals"), old_deal,
+    indexed_by<name("expires"), const_mem_fun<old_deal, uint64_t, &old_deal::get_expires>>,
+    indexed_by<name("arbiters"), const_mem_fun<old_deal, uint64_t, &old_deal::get_arbiter>>> old_deals;
+
+  struct old_arbiter {
+    name           account;
+    string         contact_name;
+    string         email;
+    string         description;
+    string         website;
+    string         phone;
+    string         iso_country;
+    uint32_t       processed_deals = 0;
+    uint8_t        is_active;
+    auto primary_key()const { return account.value; }
+    uint64_t get_is_active()const { return is_active; }
+  };
+
+  typedef eosio::multi_index<
+    name("arbiters"), old_arbiter,
+    indexed_by<name("active"), const_mem_fun<old_arbiter, uint64_t, &old_arbiter::get_is_active>>> old_arbiters;
+
+  name old_arbiter_name(size_t k) { return account_name("oldarb", k); }
+
+
+  // n deals left by the old contract in every state, five of them per
+  // state cycle: new, accepted, funded, delivered and in arbitration.
+  // Every 50th deal names an arbiter registered before arbstats existed,
+  // and a third such arbiter retired before the upgrade. Arbiter 0
+  // retires before migrate, which moves the deals in chunks; then every
+  // deal is closed and the retired arbiter goes with its last deal.
+  void workload_migrate(size_t n)
+  {
+    auto& c = chain::instance();
+    const uint16_t STATE_FLAGS[5] = {
+      BUYER_ACCEPTED_FLAG, BOTH_ACCEPTED_FLAG, BOTH_ACCEPTED_FLAG | DEAL_FUNDED_FLAG,
+      BOTH_ACCEPTED_FLAG | DEAL_FUNDED_FLAG | DEAL_DELIVERED_FLAG,
+      BOTH_ACCEPTED_FLAG | DEAL_FUNDED_FLAG | DEAL_DELIVERED_FLAG | DEAL_ARBITRATION_FLAG };
+    auto arbiter_of = [&]( size_t i ) { return (i % 50 == 49) ? old_arbiter_name(i % 2) : arbiter(i); };
+    std::map<name, std::pair<uint32_t, uint32_t>> expected;   // open deals and disputes
+    size_t funded = 0, disputes = 0;
+    for( size_t k = 0; k < 3; k++ ) {
+      c.create_account(old_arbiter_name(k));
+    }
+    c.set_code(ESCROW, [&]( name receiver, name code, name action ) {
+        old_arbiters arbs(ESCROW, ESCROW.value);
+        for( size_t k = 0; k < 3; k++ ) {
+          arbs.emplace(ESCROW, [&]( auto& a ) {
+              a.account = old_arbiter_name(k);
+              a.contact_name = "Arbiter";
+              a.email = "arbiter@example.com";
+              a.iso_country = "US";
+              a.processed_deals = 5;
+              a.is_active = (k < 2) ? 1 : 0;
+            });
+        }
+        old_deals deals(ESCROW, ESCROW.value);
+        const time_point_sec now(c.now());
+        for( size_t i = 0; i < n; i++ ) {
+          const uint16_t flags = STATE_FLAGS[i % 5];
+          deals.emplace(ESCROW, [&]( auto& d ) {
+              d.id = i + 1;
+              d.created_by = buyer(i);
+              d.description = DESCRIPTION;
+              d.price = extended_asset(asset(PRICE, SYM), TOKEN);
+              d.buyer = buyer(i);
+              d.seller = seller(i);
+              d.arbiter = arbiter_of(i);
+              d.days = 30;
+              d.flags = flags;
+              if( flags & DEAL_FUNDED_FLAG ) d.funded = now;
+              if( flags & DEAL_ARBITRATION_FLAG ) d.expires = time_point_sec();
+              else if( flags & DEAL_DELIVERED_FLAG ) d.expires = now + DELIVERED_DEAL_EXPIRES;
+              else if( flags & DEAL_FUNDED_FLAG ) d.expires = now + 30 * DAY_SEC;
+              else d.expires = now + NEW_DEAL_EXPIRES;
+            });
+        }
+      });
+    c.push_action(ESCROW, name("seed"), ESCROW);
+    c.set_code(ESCROW, escrow_apply);
+    for( size_t i = 0; i < n; i++ ) {
+      const uint16_t flags = STATE_FLAGS[i % 5];
+      auto& e = expected[arbiter_of(i)];
+      e.first++;
+      if( flags & DEAL_ARBITRATION_FLAG ) {
+        e.second++;
+        disputes++;
+      }
+      if( flags & DEAL_FUNDED_FLAG ) funded++;
+      // an observer of the old contract knows the arbiter of each deal
+      obs.arbiters[i + 1] = arbiter_of(i);
+    }
+    // the old contract held the escrowed tokens
+    if( funded > 0 ) {
+      c.push_action(TOKEN, name("issue"), TOKEN, ESCROW, asset(PRICE * funded, SYM));
+    }
+    c.reset_stats();
+
+    // the directory after fillarbstats includes the old active arbiters
+    auto directory = [&]() {
+      std::map<name, escrowescrow::arbiter_summary> listed;
+      escrowescrow::arbiter_page page { .more=true, .next_processed=0xFFFFFFFF };
+      while( page.more && c.push_action(ESCROW, name("getarbiters"), KEEPER, string(),
+                                        page.next_processed, page.next_account, uint16_t(100)) ) {
+        page = eosio::unpack<escrowescrow::arbiter_page>(eosio::native::action_return_value());
+        for( const auto& a : page.arbiters ) listed[a.account] = a;
+      }
+      return listed;
+    };
+    expect(directory().size() == NUM_ARBITERS, "arbiters without arbstats are not listed");
+    name from;
+    size_t fills = 0;
+    do {
+      if( !c.push_action(ESCROW, name("fillarbstats"), ESCROW, from, uint32_t(4)) ) break;
+      from = eosio::unpack<name>(eosio::native::action_return_value());
+      fills++;
+    } while( from != name() );
+    expect(directory().size() == NUM_ARBITERS + 2, "fillarbstats lists the old active arbiters");
+
+    // the arbiter retired before the upgrade is deleted on a second delarbiter;
+    // arbiter 0 has only unmigrated deals and stays until they close
+    const size_t arbiter_rows = c.row_count(ESCROW, name("arbiters"));
+    expect(c.push_action(ESCROW, name("delarbiter"), old_arbiter_name(2), old_arbiter_name(2)) &&
+           c.row_count(ESCROW, name("arbiters")) == arbiter_rows - 1,
+           "an arbiter retired before the upgrade is deleted");
+    expect(c.push_action(ESCROW, name("delarbiter"), arbiter(0), arbiter(0)) &&
+           c.row_count(ESCROW, name("arbiters")) == arbiter_rows - 1,
+           "an arbiter with unmigrated deals is kept");
+
+    size_t calls = 0;
+    while( c.push_action(ESCROW, name("migrate"), ESCROW, uint32_t(BATCH_SIZE)) ) {
+      calls++;
+    }
+    printf("  %zu old deals migrated in %zu migrate calls, %zu fillarbstats calls\n",
+           c.row_count(ESCROW, name("dealstate")), calls, fills);
+    expect(c.row_count(ESCROW, name("deals")) == 0 && c.row_count(ESCROW, name("dealstate")) == n &&
+           failures("There are no deals to migrate") == 1, "every old deal is migrated");
+
+    vector<eosio::extended_symbol> tokens = {{SYM, TOKEN}};
+    if( c.push_action(ESCROW, name("gettelemetry"), KEEPER, tokens) ) {
+      auto tm = eosio::unpack<escrowescrow::telemetry_view>(eosio::native::action_return_value());
+      expect(tm.counters.open_deals == n && tm.counters.funded == funded &&
+             tm.counters.arbitration == disputes && tm.escrowed[0].quantity.amount == PRICE * int64_t(funded),
+             "telemetry and ledger count the migrated deals");
+    }
+    size_t mismatched = 0;
+    for( const auto& [account, a] : directory() ) {
+      const auto& e = expected[account];
+      if( a.open_deals != e.first || a.open_disputes != e.second ) mismatched++;
+    }
+    expect(mismatched == 0, "arbstats count the open deals and disputes of the migrated deals");
+
+    size_t closed = 0;
+    for( size_t i = 0; i < n; i++ ) {
+      const uint64_t id = i + 1;
+      bool ok = false;
+      switch( i % 5 ) {
+      case 0:
+      case 1: ok = c.push_action(ESCROW, name("cancel"), buyer(i), id); break;
+      case 2: ok = c.push_action(ESCROW, name("cancel"), seller(i), id); break;
+      case 3: ok = c.push_action(ESCROW, name("goodsrcvd"), buyer(i), id); break;
+      case 4: ok = c.push_action(ESCROW, (i & 1) ? name("arbrefund") : name("arbenforce"), arbiter_of(i), id); break;
+      }
+      if( ok ) closed++;
+    }
+    c.run_deferred();
+    printf("  %zu migrated deals closed\n", closed);
+    expect(closed == n, "every migrated deal is closed");
+    expect(c.row_count(ESCROW, name("arbiters")) == arbiter_rows - 2,
+           "the retired arbiter goes with its last migrated deal");
+  }
+
+
+  // An arbiter directory of n/10 arbiters in 20 countries, listed page by
+  // page for every country and for all countries
+  void workload_directory(size_t n)
+  {
+    static const char* countries[] = {
+      "AR", "AU", "BR", "CA", "CH", "CN", "DE", "ES", "FR", "GB",
+      "IN", "IT", "JP", "KR", "MX", "NL", "RU", "SE", "UA", "US" };
+    auto& c = chain::instance();
+    const size_t count = n / 10;
+    for( size_t i = 0; i < count; i++ ) {
+      name a = account_name("dirarb", i);
+      c.create_account(a);
+      c.push_action(ESCROW, name("setarbiter"), a, a, string("Arbiter"),
+                    string("arbiter@example.com"), string(DESCRIPTION), string("https://example.com"),
+                    string("+10000000000"), string(countries[i % 20]));
+    }
+    c.reset_stats();
+
+    size_t found = 0;
+    size_t calls = 0;
+    auto list = [&]( const string& country ) {
+      escrowescrow::arbiter_page page { .more=true, .next_processed=0xFFFFFFFF };
+      while( page.more ) {
+        if( !c.push_action(ESCROW, name("getarbiters"), KEEPER, country,
+                           page.next_processed, page.next_account, uint16_t(50)) ) {
+          break;
+        }
+        page = eosio::unpack<escrowescrow::arbiter_page>(eosio::native::action_return_value());
+        found += page.arbiters.size();
+        calls++;
+      }
+    };
+    for( const char* country : countries ) {
+      list(country);
+    }
+    list(string());
+    printf("  %zu directory entries listed in %zu getarbiters calls\n", found, calls);
+    expect(found == 2 * count + NUM_ARBITERS * 2, "every arbiter is listed by country and in the ranking");
+  }
+
+
+  // Every buyer pages through its accepted deals, 20 per getdeals call
+  void workload_query(size_t n)
+  {
+    auto& c = chain::instance();
+    open_deals(n, 2, 30);
+    c.reset_stats();
+
+    size_t found = 0;
+    size_t calls = 0;
+    for( size_t b = 0; b < NUM_BUYERS && b < n; b++ ) {
+      escrowescrow::deal_page page { .more=true };
+      while( page.more ) {
+        if( !c.push_action(ESCROW, name("getdeals"), KEEPER, buyer(b), name("buyer"),
+                           ACCEPTED_FLAGS, ACCEPTED_FLAGS,
+                           page.next_expires, page.next_id, uint16_t(20)) ) {
+          break;
+        }
+        page = eosio::unpack<escrowescrow::deal_page>(eosio::native::action_return_value());
+        found += page.deals.size();
+        calls++;
+      }
+    }
+    printf("  %zu accepted deals found in %zu getdeals calls\n", found, calls);
+    expect(found == n, "every accepted deal is found");
+  }
+
+
+  void report(const char* title, size_t n, double seconds)
+  {
+    auto& c = chain::instance();
+    printf("\n== %s: %zu deals, %.2f s wall\n", title, n, seconds);
+    printf("%-24s %9s %6s %7s %7s %8s %8s %7s %8s %7s %7s %7s %8s\n",
+           "action", "calls", "fails", "reads", "writes", "rowbytes", "ram", "inline", "inbytes",
+           "notify", "defer", "allocs", "us");
+    for( const auto& s : c.stats() ) {
+      const action_cost& a = s.second;
+      double k = a.calls ? 1.0 / a.calls : 0;
+      printf("%-24s %9llu %6llu %7.2f %7.2f %8.1f %8.1f %7.2f %8.1f %7.2f %7.2f %7.1f %8.2f\n",
+             s.first.c_str(), (unsigned long long)a.calls, (unsigned long long)a.failures,
+             a.db_reads * k, a.db_writes * k, a.row_bytes * k, a.ram_delta * k,
+             a.inline_actions * k, a.inline_bytes * k, a.notifications * k, a.deferred * k,
+             a.allocs * k, a.wall_ns * k / 1000.0);
+    }
+    for( const auto& e : c.errors() ) {
+      printf("  failed %llu times: %s\n", (unsigned long long)e.second, e.first.c_str());
+    }
+    printf("  deals: %zu state rows, %zu text rows, RAM in use: %lld bytes total, %lld bytes paid by %s\n",
+           c.row_count(ESCROW, name("dealstate")), c.row_count(ESCROW, name("dealtexts")),
+           (long long)c.ram_total(),
+           (long long)c.ram_usage(ESCROW), ESCROW.to_string().c_str());
+    if( obs.seq_gaps > 0 ) {
+      printf("  dealevent sequence gaps: %zu\n", obs.seq_gaps);
+    }
+    expect(obs.seq_gaps == 0, "no dealevent sequence gaps");
+    expect(obs.funded_moves == 0, "the funding time of a deal never changes");
+    size_t listed = 0, mismatched = 0;
+    escrowescrow::arbiter_page page { .more=true, .next_processed=0xFFFFFFFF };
+    while( page.more && c.push_action(ESCROW, name("getarbiters"), KEEPER, string(),
+                                      page.next_processed, page.next_account, uint16_t(100)) ) {
+      page = eosio::unpack<escrowescrow::arbiter_page>(eosio::native::action_return_value());
+      for( const auto& a : page.arbiters ) {
+        const auto& r = obs.resolutions[a.account];
+        if( a.refunds != r.refunds || a.enforcements != r.enforcements ) mismatched++;
+        listed++;
+      }
+    }
+    expect(listed > 0 && mismatched == 0, "the traced resolutions match getarbiters");
+    vector<eosio::extended_symbol> tokens = {{SYM, TOKEN}};
+    const bool telemetry_read = c.push_action(ESCROW, name("gettelemetry"), KEEPER, tokens);
+    expect(telemetry_read, "gettelemetry succeeds");
+    if( telemetry_read ) {
+      auto tm = eosio::unpack<escrowescrow::telemetry_view>(eosio::native::action_return_value());
+      const auto& t = tm.counters;
+      expect(t.open_deals == c.row_count(ESCROW, name("dealstate")), "telemetry counts every open deal");
+      printf("  telemetry: %u open, %u funded, %u delivered, %u in arbitration; %llu created, %llu closed,"
+             " %llu canceled, %llu expired, %llu arbitrated; %s in escrow\n",
+             t.open_deals, t.funded, t.delivered, t.arbitration, (unsigned long long)t.created,
+             (unsigned long long)t.closed, (unsigned long long)t.canceled, (unsigned long long)t.expired,
+             (unsigned long long)t.arbitrated, tm.escrowed[0].quantity.to_string().c_str());
+    }
+    const bool reconciled = c.push_action(ESCROW, name("reconcile"), KEEPER, tokens[0]);
+    expect(reconciled, "reconcile succeeds");
+    if( reconciled ) {
+      auto r = eosio::unpack<escrowescrow::reconciliation>(eosio::native::action_return_value());
+      printf("  reconcile: %s escrowed, %s held, %s\n", r.escrowed.quantity.to_string().c_str(),
+             r.balance.quantity.to_string().c_str(), r.solvent ? "solvent" : "NOT SOLVENT");
+      expect(r.solvent, "the contract balance covers the ledger");
+    }
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  size_t n = 100000;
+  std::vector<string> workloads;
+  for( int i = 1; i < argc; i++ ) {
+    if( strcmp(argv[i], "--deals") == 0 && i + 1 < argc ) {
+      n = strtoull(argv[++i], nullptr, 10);
+    }
+    else if( strcmp(argv[i], "--workload") == 0 && i + 1 < argc ) {
+      workloads.push_back(argv[++i]);
+    }
+    else if( strcmp(argv[i], "--legacy-ids") == 0 ) {
+      legacy_ids = true;
+    }
+    else if( strcmp(argv[i], "--compact") == 0 ) {
+      compact = true;
+    }
+    else if( strcmp(argv[i], "--tokens") == 0 && i + 1 < argc ) {
+      const char* mode = argv[++i];
+      if( strcmp(mode, "open") == 0 ) token_mode = 0;
+      else if( strcmp(mode, "listed") == 0 ) token_mode = 1;
+      else if( strcmp(mode, "strict") == 0 ) token_mode = 2;
+      else {
+        fprintf(stderr, "Unknown token mode: %s\n", mode);
+        return 1;
+      }
+    }
+    else if( strcmp(argv[i], "--trace") == 0 && i + 1 < argc ) {
+      trace_file = fopen(argv[++i], "wb");
+      if( trace_file == nullptr ) {
+        fprintf(stderr, "Cannot open %s\n", argv[i]);
+        return 1;
+      }
+    }
+    else {
+      fprintf(stderr, "Usage: %s [--deals N] [--legacy-ids] [--compact] [--tokens open|listed|strict] [--trace FILE] [--workload lifecycle|batch|bulkfund|settle|expiry|arbitration|query|directory|templates|policy|prepaid|subscribed|receipts|milestones|migrate]...\n", argv[0]);
+      return 1;
+    }
+  }
+  if( trace_file && workloads.size() != 1 ) {
+    fprintf(stderr, "--trace needs exactly one --workload\n");
+    return 1;
+  }
+  if( workloads.empty() ) {
+    workloads = {"lifecycle", "batch", "bulkfund", "settle", "expiry", "arbitration", "query", "directory",
+                 "templates", "policy", "prepaid", "subscribed", "receipts", "milestones", "migrate"};
+  }
+
+  for( const auto& w : workloads ) {
+    setup();
+    auto start = std::chrono::steady_clock::now();
+    if( w == "lifecycle" ) workload_lifecycle(n);
+    else if( w == "batch" ) workload_batch(n);
+    else if( w == "bulkfund" ) workload_bulkfund(n);
+    else if( w == "settle" ) workload_settle(n);
+    else if( w == "expiry" ) workload_expiry(n);
+    else if( w == "arbitration" ) workload_arbitration(n);
+    else if( w == "query" ) workload_query(n);
+    else if( w == "directory" ) workload_directory(n);
+    else if( w == "templates" ) workload_templates(n);
+    else if( w == "policy" ) workload_policy(n);
+    else if( w == "prepaid" ) workload_prepaid(n);
+    else if( w == "subscribed" ) workload_subscribed(n);
+    else if( w == "receipts" ) workload_receipts(n);
+    else if( w == "milestones" ) workload_milestones(n);
+    else if( w == "migrate" ) workload_migrate(n);
+    else {
+      fprintf(stderr, "Unknown workload: %s\n", w.c_str());
+      return 1;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    report(w.c_str(), n, elapsed.count());
+  }
+  if( trace_file ) {
+    fclose(trace_file);
+  }
+  if( failed_checks > 0 ) {
+    printf("\n%zu checks failed\n", failed_checks);
+    return 1;
+  }
+  return 0;
+}
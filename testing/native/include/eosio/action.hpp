@@ -0,0 +1,128 @@
+/*
+  Native stand-in for <eosio/action.hpp>.
+
+  Inline actions are serialized and queued on the simulated chain, which
+  dispatches them after the current action returns, the same order nodeos
+  uses: notifications first, then inline actions.
+*/
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <eosio/check.hpp>
+#include <eosio/name.hpp>
+#include <eosio/datastream.hpp>
+#include <eosio/native/chain.hpp>
+
+namespace eosio {
+
+  struct permission_level {
+    permission_level(name a, name p) : actor(a), permission(p) {}
+    permission_level() {}
+
+    name actor;
+    name permission;
+
+    friend bool operator==(const permission_level& a, const permission_level& b) {
+      return a.actor == b.actor && a.permission == b.permission;
+    }
+  };
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const permission_level& v) { return ds << v.actor << v.permission; }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, permission_level& v) { return ds >> v.actor >> v.permission; }
+
+
+  inline void require_auth(name n) {
+    check(native::chain::instance().has_auth(n), "missing authority of " + n.to_string());
+  }
+
+  inline void require_auth(const permission_level& level) {
+    require_auth(level.actor);
+  }
+
+  inline bool has_auth(name n) {
+    return native::chain::instance().has_auth(n);
+  }
+
+  inline void require_recipient(name notify_account) {
+    native::chain::instance().require_recipient(notify_account);
+  }
+
+  template<typename... accounts>
+  void require_recipient(name notify_account, accounts... remaining_accounts) {
+    require_recipient(notify_account);
+    require_recipient(remaining_accounts...);
+  }
+
+  inline uint32_t action_data_size() {
+    return native::chain::instance().action_data().size();
+  }
+
+  inline uint32_t read_action_data(void* msg, uint32_t len) {
+    const auto& d = native::chain::instance().action_data();
+    uint32_t n = std::min<uint32_t>(len, d.size());
+    memcpy(msg, d.data(), n);
+    return n;
+  }
+
+  template<typename T>
+  T unpack_action_data() {
+    return unpack<T>(native::chain::instance().action_data());
+  }
+
+
+  struct action {
+    eosio::name account;
+    eosio::name name;
+    std::vector<permission_level> authorization;
+    std::vector<char> data;
+
+    action() = default;
+
+    template<typename T>
+    action(const permission_level& auth, struct name a, struct name n, T&& value)
+      : account(a), name(n), authorization(1, auth), data(pack(std::forward<T>(value))) {}
+
+    template<typename T>
+    action(std::vector<permission_level> auths, struct name a, struct name n, T&& value)
+      : account(a), name(n), authorization(std::move(auths)), data(pack(std::forward<T>(value))) {}
+
+    native::packed_action to_packed() const {
+      native::packed_action p{account, name, {}, data};
+      for( const auto& l : authorization ) {
+        p.authorization.emplace_back(l.actor, l.permission);
+      }
+      return p;
+    }
+
+    void send() const {
+      native::chain::instance().send_inline(to_packed());
+    }
+
+    void send_context_free() const {
+      check(authorization.empty(), "context free actions cannot have authorizations");
+      send();
+    }
+
+    template<typename T>
+    T data_as() {
+      return unpack<T>(data);
+    }
+  };
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const action& v) {
+    return ds << v.account << v.name << v.authorization << v.data;
+  }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, action& v) {
+    return ds >> v.account >> v.name >> v.authorization >> v.data;
+  }
+}
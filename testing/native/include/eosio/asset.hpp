@@ -0,0 +1,132 @@
+/*
+  Native stand-in for <eosio/asset.hpp>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+
+#include <eosio/check.hpp>
+#include <eosio/name.hpp>
+#include <eosio/symbol.hpp>
+
+namespace eosio {
+
+  struct asset {
+    static constexpr int64_t max_amount = (1LL << 62) - 1;
+
+    int64_t amount = 0;
+    eosio::symbol symbol;
+
+    asset() {}
+    asset(int64_t a, class symbol s) : amount(a), symbol{s} {
+      check(is_amount_within_range(), "magnitude of asset amount must be less than 2^62");
+      check(symbol.is_valid(), "invalid symbol name");
+    }
+
+    bool is_amount_within_range() const { return -max_amount <= amount && amount <= max_amount; }
+    bool is_valid() const { return is_amount_within_range() && symbol.is_valid(); }
+
+    asset operator-() const {
+      asset r = *this;
+      r.amount = -r.amount;
+      return r;
+    }
+
+    asset& operator-=(const asset& a) {
+      check(a.symbol == symbol, "attempt to subtract asset with different symbol");
+      amount -= a.amount;
+      check(-max_amount <= amount, "subtraction underflow");
+      check(amount <= max_amount, "subtraction overflow");
+      return *this;
+    }
+
+    asset& operator+=(const asset& a) {
+      check(a.symbol == symbol, "attempt to add asset with different symbol");
+      amount += a.amount;
+      check(-max_amount <= amount, "addition underflow");
+      check(amount <= max_amount, "addition overflow");
+      return *this;
+    }
+
+    friend asset operator+(const asset& a, const asset& b) {
+      asset result = a;
+      result += b;
+      return result;
+    }
+
+    friend asset operator-(const asset& a, const asset& b) {
+      asset result = a;
+      result -= b;
+      return result;
+    }
+
+    std::string to_string() const {
+      int64_t p = (int64_t)symbol.precision();
+      int64_t p10 = 1;
+      for( int64_t i = 0; i < p; i++ ) p10 *= 10;
+      bool negative = amount < 0;
+      uint64_t abs_amount = negative ? (uint64_t)(-amount) : (uint64_t)amount;
+      std::string result = std::to_string(abs_amount / p10);
+      if( p > 0 ) {
+        std::string fract = std::to_string(abs_amount % p10);
+        result += "." + std::string(p - fract.size(), '0') + fract;
+      }
+      return (negative ? "-" : "") + result + " " + symbol.code().to_string();
+    }
+
+    friend bool operator==(const asset& a, const asset& b) {
+      check(a.symbol == b.symbol, "comparison of assets with different symbols is not allowed");
+      return a.amount == b.amount;
+    }
+
+    friend bool operator!=(const asset& a, const asset& b) { return !(a == b); }
+
+    friend bool operator<(const asset& a, const asset& b) {
+      check(a.symbol == b.symbol, "comparison of assets with different symbols is not allowed");
+      return a.amount < b.amount;
+    }
+
+    friend bool operator<=(const asset& a, const asset& b) {
+      check(a.symbol == b.symbol, "comparison of assets with different symbols is not allowed");
+      return a.amount <= b.amount;
+    }
+
+    friend bool operator>(const asset& a, const asset& b) { return b < a; }
+    friend bool operator>=(const asset& a, const asset& b) { return b <= a; }
+  };
+
+
+  struct extended_asset {
+    asset quantity;
+    name contract;
+
+    extended_symbol get_extended_symbol() const { return extended_symbol{quantity.symbol, contract}; }
+
+    extended_asset() = default;
+    extended_asset(int64_t v, extended_symbol s) : quantity(v, s.get_symbol()), contract(s.get_contract()) {}
+    extended_asset(asset a, name c) : quantity(a), contract(c) {}
+
+    std::string to_string() const { return quantity.to_string() + "@" + contract.to_string(); }
+
+    extended_asset& operator+=(const extended_asset& b) {
+      check(contract == b.contract, "type mismatch");
+      quantity += b.quantity;
+      return *this;
+    }
+
+    extended_asset& operator-=(const extended_asset& b) {
+      check(contract == b.contract, "type mismatch");
+      quantity -= b.quantity;
+      return *this;
+    }
+
+    friend bool operator==(const extended_asset& a, const extended_asset& b) {
+      return std::tie(a.quantity, a.contract) == std::tie(b.quantity, b.contract);
+    }
+
+    friend bool operator!=(const extended_asset& a, const extended_asset& b) { return !(a == b); }
+  };
+}
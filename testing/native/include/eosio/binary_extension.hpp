@@ -0,0 +1,62 @@
+/*
+  Native stand-in for <eosio/binary_extension.hpp>.
+
+  A trailing field that may be absent from the serialized data. It is
+  written only when it holds a value and read only when the stream has
+  bytes left, so data packed before the field was added still unpacks.
+*/
+
+#pragma once
+
+#include <optional>
+#include <utility>
+
+#include <eosio/check.hpp>
+
+namespace eosio {
+
+  template<typename T>
+  class binary_extension {
+  public:
+    binary_extension() = default;
+    binary_extension(const T& v) : _value(v) {}
+    binary_extension(T&& v) : _value(std::move(v)) {}
+
+    bool has_value() const { return _value.has_value(); }
+    explicit operator bool() const { return has_value(); }
+
+    const T& value() const {
+      check(has_value(), "cannot get value of empty binary_extension");
+      return *_value;
+    }
+
+    T value_or(const T& def = T()) const { return has_value() ? *_value : def; }
+
+    template<typename... Args>
+    binary_extension& emplace(Args&&... args) {
+      _value.emplace(std::forward<Args>(args)...);
+      return *this;
+    }
+
+    void reset() { _value.reset(); }
+
+  private:
+    std::optional<T> _value;
+  };
+
+  template<typename Stream, typename T>
+  Stream& operator<<(Stream& ds, const binary_extension<T>& be) {
+    if( be.has_value() ) ds << be.value();
+    return ds;
+  }
+
+  template<typename Stream, typename T>
+  Stream& operator>>(Stream& ds, binary_extension<T>& be) {
+    if( ds.remaining() ) {
+      T val;
+      ds >> val;
+      be.emplace(std::move(val));
+    }
+    return ds;
+  }
+}
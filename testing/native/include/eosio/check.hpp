@@ -0,0 +1,43 @@
+/*
+  Native stand-in for <eosio/check.hpp>.
+
+  A failed check aborts the current action by throwing check_failure; the
+  simulated chain catches it and rolls the whole transaction back.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace eosio {
+
+  namespace native {
+    struct check_failure : public std::runtime_error {
+      explicit check_failure(const std::string& msg) : std::runtime_error(msg) {}
+    };
+  }
+
+  inline void check(bool pred, const char* msg) {
+    if( !pred ) throw native::check_failure(msg);
+  }
+
+  inline void check(bool pred, const std::string& msg) {
+    if( !pred ) throw native::check_failure(msg);
+  }
+
+  inline void check(bool pred, std::string_view msg) {
+    if( !pred ) throw native::check_failure(std::string(msg));
+  }
+
+  inline void check(bool pred, const char* msg, size_t n) {
+    if( !pred ) throw native::check_failure(std::string(msg, n));
+  }
+
+  inline void check(bool pred, uint64_t code) {
+    if( !pred ) throw native::check_failure("assertion failure with error code: " + std::to_string(code));
+  }
+}
@@ -0,0 +1,137 @@
+/*
+  Native stand-in for <eosio/crypto.hpp> and <eosio/fixed_bytes.hpp>.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include <eosio/datastream.hpp>
+
+namespace eosio {
+
+  // Stored the way the wasm intrinsics leave it in memory: two
+  // little-endian 128-bit words. extract_as_byte_array() therefore
+  // reverses each half, exactly like the CDT fixed_bytes on chain.
+  template<size_t Size>
+  class fixed_bytes {
+  public:
+    fixed_bytes() { _data.fill(0); }
+
+    explicit fixed_bytes(const std::array<uint8_t, Size>& arr) {
+      for( size_t w = 0; w < Size / 16; w++ ) {
+        for( size_t i = 0; i < 16; i++ ) {
+          _data[w*16 + i] = arr[w*16 + 15 - i];
+        }
+      }
+    }
+
+    std::array<uint8_t, Size> extract_as_byte_array() const {
+      std::array<uint8_t, Size> arr;
+      for( size_t w = 0; w < Size / 16; w++ ) {
+        for( size_t i = 0; i < 16; i++ ) {
+          arr[w*16 + i] = _data[w*16 + 15 - i];
+        }
+      }
+      return arr;
+    }
+
+    uint8_t* data() { return _data.data(); }
+    const uint8_t* data() const { return _data.data(); }
+    static constexpr size_t size() { return Size; }
+
+    friend bool operator==(const fixed_bytes& a, const fixed_bytes& b) { return a._data == b._data; }
+    friend bool operator!=(const fixed_bytes& a, const fixed_bytes& b) { return a._data != b._data; }
+    friend bool operator<(const fixed_bytes& a, const fixed_bytes& b) {
+      return a.extract_as_byte_array() < b.extract_as_byte_array();
+    }
+
+    std::array<uint8_t, Size> _data;
+  };
+
+  using checksum160 = fixed_bytes<20>;
+  using checksum256 = fixed_bytes<32>;
+  using checksum512 = fixed_bytes<64>;
+
+  template<typename Stream, size_t Size>
+  Stream& operator<<(Stream& ds, const fixed_bytes<Size>& v) {
+    ds.write((const char*)v._data.data(), Size);
+    return ds;
+  }
+
+  template<typename Stream, size_t Size>
+  Stream& operator>>(Stream& ds, fixed_bytes<Size>& v) {
+    ds.read((char*)v._data.data(), Size);
+    return ds;
+  }
+
+
+  namespace native {
+
+    inline void sha256_digest(const char* data, size_t length, uint8_t out[32]) {
+      static const uint32_t k[64] = {
+        0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+        0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+        0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+        0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+        0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+        0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+        0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+        0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2 };
+      uint32_t h[8] = { 0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,
+                        0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19 };
+      auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+      auto block = [&](const uint8_t* p) {
+        uint32_t w[64];
+        for( int i = 0; i < 16; i++ )
+          w[i] = (uint32_t(p[4*i]) << 24) | (uint32_t(p[4*i+1]) << 16) | (uint32_t(p[4*i+2]) << 8) | p[4*i+3];
+        for( int i = 16; i < 64; i++ ) {
+          uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+          uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+          w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+        uint32_t a=h[0], b=h[1], c=h[2], d=h[3], e=h[4], f=h[5], g=h[6], hh=h[7];
+        for( int i = 0; i < 64; i++ ) {
+          uint32_t t1 = hh + (rotr(e,6) ^ rotr(e,11) ^ rotr(e,25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+          uint32_t t2 = (rotr(a,2) ^ rotr(a,13) ^ rotr(a,22)) + ((a & b) ^ (a & c) ^ (b & c));
+          hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0]+=a; h[1]+=b; h[2]+=c; h[3]+=d; h[4]+=e; h[5]+=f; h[6]+=g; h[7]+=hh;
+      };
+
+      size_t full = length / 64;
+      for( size_t i = 0; i < full; i++ ) block((const uint8_t*)data + 64*i);
+
+      uint8_t tail[128] = {0};
+      size_t rest = length - full*64;
+      memcpy(tail, data + full*64, rest);
+      tail[rest] = 0x80;
+      size_t tail_len = (rest + 9 <= 64) ? 64 : 128;
+      uint64_t bits = uint64_t(length) * 8;
+      for( int i = 0; i < 8; i++ ) tail[tail_len - 1 - i] = uint8_t(bits >> (8*i));
+      block(tail);
+      if( tail_len == 128 ) block(tail + 64);
+
+      for( int i = 0; i < 8; i++ ) {
+        out[4*i] = uint8_t(h[i] >> 24);
+        out[4*i+1] = uint8_t(h[i] >> 16);
+        out[4*i+2] = uint8_t(h[i] >> 8);
+        out[4*i+3] = uint8_t(h[i]);
+      }
+    }
+  }
+
+
+  inline checksum256 sha256(const char* data, uint32_t length) {
+    checksum256 h;
+    native::sha256_digest(data, length, h.data());
+    return h;
+  }
+
+  inline void assert_sha256(const char* data, uint32_t length, const checksum256& hash) {
+    check(sha256(data, length) == hash, "hash mismatch");
+  }
+}
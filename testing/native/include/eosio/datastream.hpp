@@ -0,0 +1,383 @@
+/*
+  Native stand-in for <eosio/datastream.hpp>.
+
+  Uses the same binary layout as the chain ABI serializer, so packed sizes
+  reported by the simulator match what nodeos stores and bills.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <eosio/check.hpp>
+#include <eosio/name.hpp>
+#include <eosio/symbol.hpp>
+#include <eosio/asset.hpp>
+#include <eosio/time.hpp>
+#include <eosio/varint.hpp>
+#include <eosio/native/reflect.hpp>
+
+namespace eosio {
+
+  template<typename T>
+  class datastream {
+  public:
+    datastream(T start, size_t s) : _start(start), _pos(start), _end(start + s) {}
+
+    void skip(size_t s) { _pos += s; }
+
+    bool read(char* d, size_t s) {
+      check(size_t(_end - _pos) >= s, "datastream attempted to read past the end");
+      memcpy(d, _pos, s);
+      _pos += s;
+      return true;
+    }
+
+    bool write(const char* d, size_t s) {
+      check(_end - _pos >= (int32_t)s, "datastream attempted to write past the end");
+      memcpy((void*)_pos, d, s);
+      _pos += s;
+      return true;
+    }
+
+    bool write(char d) { return write(&d, 1); }
+
+    T pos() const { return _pos; }
+    bool valid() const { return _pos <= _end && _pos >= _start; }
+    bool seekp(size_t p) { _pos = _start + p; return _pos <= _end; }
+    size_t tellp() const { return size_t(_pos - _start); }
+    size_t remaining() const { return _end - _pos; }
+
+  private:
+    T _start;
+    T _pos;
+    T _end;
+  };
+
+
+  // Counts bytes instead of writing them
+  template<>
+  class datastream<size_t> {
+  public:
+    datastream(size_t init_size = 0) : _size(init_size) {}
+    bool skip(size_t s) { _size += s; return true; }
+    bool write(const char*, size_t s) { _size += s; return true; }
+    bool write(char) { _size++; return true; }
+    bool valid() const { return true; }
+    bool seekp(size_t p) { _size = p; return true; }
+    size_t tellp() const { return _size; }
+    size_t remaining() const { return 0; }
+  private:
+    size_t _size;
+  };
+
+
+  template<typename Stream, typename T>
+    requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+  Stream& operator<<(Stream& ds, const T& v) {
+    ds.write((const char*)&v, sizeof(T));
+    return ds;
+  }
+
+  template<typename Stream, typename T>
+    requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+  Stream& operator>>(Stream& ds, T& v) {
+    ds.read((char*)&v, sizeof(T));
+    return ds;
+  }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const bool& v) {
+    return ds << uint8_t(v);
+  }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, bool& v) {
+    uint8_t b;
+    ds >> b;
+    v = b;
+    return ds;
+  }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const unsigned_int& v) {
+    uint64_t val = v.value;
+    do {
+      uint8_t b = uint8_t(val) & 0x7f;
+      val >>= 7;
+      b |= ((val > 0) << 7);
+      ds.write((char)b);
+    } while( val );
+    return ds;
+  }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, unsigned_int& vi) {
+    uint64_t v = 0;
+    char b = 0;
+    uint8_t by = 0;
+    do {
+      ds.read(&b, 1);
+      v |= uint32_t(uint8_t(b) & 0x7f) << by;
+      by += 7;
+    } while( uint8_t(b) & 0x80 );
+    vi.value = static_cast<uint32_t>(v);
+    return ds;
+  }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const name& v) { return ds << v.value; }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, name& v) { return ds >> v.value; }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const symbol_code& v) { return ds << v.raw(); }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, symbol_code& v) {
+    uint64_t raw;
+    ds >> raw;
+    v = symbol_code(raw);
+    return ds;
+  }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const symbol& v) { return ds << v.raw(); }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, symbol& v) {
+    uint64_t raw;
+    ds >> raw;
+    v = symbol(raw);
+    return ds;
+  }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const extended_symbol& v) { return ds << v.sym << v.contract; }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, extended_symbol& v) { return ds >> v.sym >> v.contract; }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const asset& v) { return ds << v.amount << v.symbol; }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, asset& v) { return ds >> v.amount >> v.symbol; }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const extended_asset& v) { return ds << v.quantity << v.contract; }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, extended_asset& v) { return ds >> v.quantity >> v.contract; }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const time_point& v) { return ds << v.elapsed._count; }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, time_point& v) { return ds >> v.elapsed._count; }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const time_point_sec& v) { return ds << v.utc_seconds; }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, time_point_sec& v) { return ds >> v.utc_seconds; }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const std::string& v) {
+    ds << unsigned_int(v.size());
+    if( v.size() ) ds.write(v.data(), v.size());
+    return ds;
+  }
+
+  template<typename Stream>
+  Stream& operator<<(Stream& ds, const std::string_view& v) {
+    ds << unsigned_int(v.size());
+    if( v.size() ) ds.write(v.data(), v.size());
+    return ds;
+  }
+
+  template<typename Stream>
+  Stream& operator>>(Stream& ds, std::string& v) {
+    unsigned_int s;
+    ds >> s;
+    v.resize(s.value);
+    if( s.value ) ds.read(v.data(), s.value);
+    return ds;
+  }
+
+  template<typename Stream, typename T, size_t N>
+  Stream& operator<<(Stream& ds, const std::array<T, N>& v) {
+    for( const auto& i : v ) ds << i;
+    return ds;
+  }
+
+  template<typename Stream, typename T, size_t N>
+  Stream& operator>>(Stream& ds, std::array<T, N>& v) {
+    for( auto& i : v ) ds >> i;
+    return ds;
+  }
+
+  template<typename Stream, typename T>
+  Stream& operator<<(Stream& ds, const std::vector<T>& v) {
+    ds << unsigned_int(v.size());
+    for( const auto& i : v ) ds << i;
+    return ds;
+  }
+
+  template<typename Stream, typename T>
+  Stream& operator>>(Stream& ds, std::vector<T>& v) {
+    unsigned_int s;
+    ds >> s;
+    v.resize(s.value);
+    for( auto& i : v ) ds >> i;
+    return ds;
+  }
+
+  template<typename Stream, typename T>
+  Stream& operator<<(Stream& ds, const std::optional<T>& v) {
+    ds << bool(v.has_value());
+    if( v ) ds << *v;
+    return ds;
+  }
+
+  template<typename Stream, typename T>
+  Stream& operator>>(Stream& ds, std::optional<T>& v) {
+    bool has;
+    ds >> has;
+    if( has ) {
+      T val;
+      ds >> val;
+      v = std::move(val);
+    }
+    else {
+      v.reset();
+    }
+    return ds;
+  }
+
+  template<typename Stream, typename K, typename V>
+  Stream& operator<<(Stream& ds, const std::pair<K, V>& v) { return ds << v.first << v.second; }
+
+  template<typename Stream, typename K, typename V>
+  Stream& operator>>(Stream& ds, std::pair<K, V>& v) { return ds >> v.first >> v.second; }
+
+  template<typename Stream, typename K, typename V>
+  Stream& operator<<(Stream& ds, const std::map<K, V>& m) {
+    ds << unsigned_int(m.size());
+    for( const auto& i : m ) ds << i.first << i.second;
+    return ds;
+  }
+
+  template<typename Stream, typename K, typename V>
+  Stream& operator>>(Stream& ds, std::map<K, V>& m) {
+    unsigned_int s;
+    ds >> s;
+    m.clear();
+    for( uint32_t i = 0; i < s.value; ++i ) {
+      K k;
+      V v;
+      ds >> k >> v;
+      m.emplace(std::move(k), std::move(v));
+    }
+    return ds;
+  }
+
+  template<typename Stream, typename... Args>
+  Stream& operator<<(Stream& ds, const std::tuple<Args...>& t) {
+    std::apply([&](const auto&... a) { ((ds << a), ...); }, t);
+    return ds;
+  }
+
+  template<typename Stream, typename... Args>
+  Stream& operator>>(Stream& ds, std::tuple<Args...>& t) {
+    std::apply([&](auto&... a) { ((ds >> a), ...); }, t);
+    return ds;
+  }
+
+  template<typename Stream, typename... Ts>
+  Stream& operator<<(Stream& ds, const std::variant<Ts...>& var) {
+    ds << unsigned_int(var.index());
+    std::visit([&](const auto& v) { ds << v; }, var);
+    return ds;
+  }
+
+  template<int I, typename Stream, typename... Ts>
+  void unpack_variant(Stream& ds, std::variant<Ts...>& var, int i) {
+    if constexpr( I < std::variant_size_v<std::variant<Ts...>> ) {
+      if( i == I ) {
+        std::variant_alternative_t<I, std::variant<Ts...>> tmp;
+        ds >> tmp;
+        var.template emplace<I>(std::move(tmp));
+      }
+      else {
+        unpack_variant<I + 1>(ds, var, i);
+      }
+    }
+    else {
+      check(false, "invalid variant index");
+    }
+  }
+
+  template<typename Stream, typename... Ts>
+  Stream& operator>>(Stream& ds, std::variant<Ts...>& var) {
+    unsigned_int index;
+    ds >> index;
+    unpack_variant<0>(ds, var, index);
+    return ds;
+  }
+
+  // Structs without a dedicated serializer are packed field by field
+  template<typename Stream, native::reflectable T>
+  Stream& operator<<(Stream& ds, const T& v) {
+    native::for_each_field(v, [&](const auto& f) { ds << f; });
+    return ds;
+  }
+
+  template<typename Stream, native::reflectable T>
+  Stream& operator>>(Stream& ds, T& v) {
+    native::for_each_field(v, [&](auto& f) { ds >> f; });
+    return ds;
+  }
+
+
+  template<typename T>
+  size_t pack_size(const T& value) {
+    datastream<size_t> ps;
+    ps << value;
+    return ps.tellp();
+  }
+
+  template<typename T>
+  std::vector<char> pack(const T& value) {
+    std::vector<char> result;
+    result.resize(pack_size(value));
+    datastream<char*> ds(result.data(), result.size());
+    ds << value;
+    return result;
+  }
+
+  template<typename T>
+  T unpack(const char* buffer, size_t len) {
+    T result;
+    datastream<const char*> ds(buffer, len);
+    ds >> result;
+    return result;
+  }
+
+  template<typename T>
+  T unpack(const std::vector<char>& bytes) {
+    return unpack<T>(bytes.data(), bytes.size());
+  }
+}
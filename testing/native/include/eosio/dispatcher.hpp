@@ -0,0 +1,57 @@
+/*
+  Native stand-in for <eosio/dispatcher.hpp>.
+
+  execute_action() unpacks the current action data into the member
+  function's arguments and calls it on a freshly constructed contract,
+  which is what the apply() generated by eosio-cpp does on chain.
+
+  A failed check aborts a WebAssembly action without running any
+  destructors, so the contract object is destroyed only when the action
+  succeeds. Contracts that flush state in their destructor, like
+  eosio.system does, then behave the same way as on chain.
+*/
+
+#pragma once
+
+#include <new>
+#include <tuple>
+#include <type_traits>
+
+#include <eosio/action.hpp>
+#include <eosio/datastream.hpp>
+#include <eosio/name.hpp>
+#include <eosio/native/chain.hpp>
+
+namespace eosio {
+
+  namespace native {
+    inline std::vector<char>& action_return_value() {
+      static std::vector<char> v;
+      return v;
+    }
+  }
+
+  inline void set_action_return_value(std::vector<char> v) {
+    native::action_return_value() = std::move(v);
+  }
+
+  template<typename T, typename R, typename... Args>
+  bool execute_action(name self, name code, R (T::*func)(Args...)) {
+    const auto& data = native::chain::instance().action_data();
+    std::tuple<std::decay_t<Args>...> args;
+    datastream<const char*> ds(data.data(), data.size());
+    ds >> args;
+    // on failure, the object and whatever it holds are leaked on purpose
+    alignas(T) unsigned char storage[sizeof(T)];
+    T* obj = new (storage) T(self, code, ds);
+    auto f2 = [&](auto&... a) { return (obj->*func)(a...); };
+    if constexpr( std::is_void_v<R> ) {
+      std::apply(f2, args);
+    }
+    else {
+      set_action_return_value(pack(std::apply(f2, args)));
+    }
+    obj->~T();
+    return true;
+  }
+}
@@ -0,0 +1,18 @@
+/*
+  Native stand-in for <eosio/eosio.hpp>, the umbrella CDT header.
+
+  These headers let escrowescrow.cpp compile as an ordinary host program
+  on top of the in-memory chain in <eosio/native/chain.hpp>.
+*/
+
+#pragma once
+
+#include <eosio/action.hpp>
+#include <eosio/binary_extension.hpp>
+#include <eosio/check.hpp>
+#include <eosio/contract.hpp>
+#include <eosio/datastream.hpp>
+#include <eosio/dispatcher.hpp>
+#include <eosio/name.hpp>
+#include <eosio/print.hpp>
+#include <eosio/system.hpp>
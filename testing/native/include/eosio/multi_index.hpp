@@ -0,0 +1,455 @@
+/*
+  Native stand-in for <eosio/multi_index.hpp>.
+
+  Rows are serialized into the simulated chain database exactly as the
+  CDT would store them, and each secondary index lives in its own table
+  ordered by (secondary key, primary key). Objects are cached per
+  multi_index instance like on chain, so references returned by find()
+  stay valid across modify() and a cached lookup costs no database read.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <eosio/check.hpp>
+#include <eosio/datastream.hpp>
+#include <eosio/name.hpp>
+#include <eosio/system.hpp>
+#include <eosio/types.h>
+#include <eosio/native/chain.hpp>
+
+namespace eosio {
+
+  constexpr static inline name same_payer{};
+
+  template<name::raw IndexName, typename Extractor>
+  struct indexed_by {
+    static constexpr uint64_t index_name = static_cast<uint64_t>(IndexName);
+    typedef Extractor secondary_extractor_type;
+  };
+
+  template<class Class, typename Type, Type (Class::*PtrToMemberFunction)() const>
+  struct const_mem_fun {
+    typedef std::remove_cv_t<std::remove_reference_t<Type>> result_type;
+
+    result_type operator()(const Class& x) const { return (x.*PtrToMemberFunction)(); }
+  };
+
+
+  template<name::raw TableName, typename T, typename... Indices>
+  class multi_index {
+  private:
+    static_assert(sizeof...(Indices) <= 16, "multi_index only supports a maximum of 16 secondary indices");
+
+    template<size_t I>
+    using index_type = std::tuple_element_t<I, std::tuple<Indices...>>;
+
+    template<size_t I>
+    using key_type = typename index_type<I>::secondary_extractor_type::result_type;
+
+    static constexpr uint64_t unset_next_primary_key = std::numeric_limits<uint64_t>::max() - 1;
+    static constexpr uint64_t no_available_primary_key = std::numeric_limits<uint64_t>::max();
+
+    name     _code;
+    uint64_t _scope;
+    mutable std::map<uint64_t, std::unique_ptr<T>> _items;
+    mutable uint64_t _next_primary_key = unset_next_primary_key;
+
+    static native::chain& db() { return native::chain::instance(); }
+
+    native::table_id table() const {
+      return {_code.value, _scope, static_cast<uint64_t>(TableName)};
+    }
+
+    native::table_id index_table(uint64_t number) const {
+      return {_code.value, _scope, (static_cast<uint64_t>(TableName) & 0xFFFFFFFFFFFFFFF0ULL) | number};
+    }
+
+    const T* cached(uint64_t pk) const {
+      auto i = _items.find(pk);
+      return i == _items.end() ? nullptr : i->second.get();
+    }
+
+    // Object for a primary key known to exist, from the cache or the database
+    const T* load(uint64_t pk) const {
+      if( auto c = cached(pk) ) return c;
+      auto r = db().db_get(table(), pk);
+      check(r != nullptr, "unable to find key");
+      auto obj = std::make_unique<T>(unpack<T>(r->data));
+      auto ptr = obj.get();
+      _items.emplace(pk, std::move(obj));
+      return ptr;
+    }
+
+    const T& owned(const T& obj, const char* msg) const {
+      auto c = cached(obj.primary_key());
+      check(c == &obj, msg);
+      return *c;
+    }
+
+    template<uint64_t IndexName, size_t I = 0>
+    static constexpr size_t find_index() {
+      static_assert(I < sizeof...(Indices), "name provided is not the name of any secondary index within multi_index");
+      if constexpr( index_type<I>::index_name == IndexName ) return I;
+      else return find_index<IndexName, I + 1>();
+    }
+
+    template<typename F, size_t... I>
+    static void for_each_index(F&& f, std::index_sequence<I...>) {
+      (f(std::integral_constant<size_t, I>{}), ...);
+    }
+
+    template<typename F>
+    static void for_each_index(F&& f) {
+      for_each_index(std::forward<F>(f), std::index_sequence_for<Indices...>{});
+    }
+
+    template<size_t I>
+    static key_type<I> extract(const T& obj) {
+      return typename index_type<I>::secondary_extractor_type()(obj);
+    }
+
+  public:
+    class const_iterator {
+    public:
+      using iterator_category = std::bidirectional_iterator_tag;
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const T*;
+      using reference = const T&;
+
+      const_iterator() {}
+
+      const T& operator*() const {
+        check(_item != nullptr, "cannot dereference end iterator");
+        return *_item;
+      }
+      const T* operator->() const { return &operator*(); }
+
+      const_iterator operator++(int) { const_iterator r = *this; ++(*this); return r; }
+      const_iterator operator--(int) { const_iterator r = *this; --(*this); return r; }
+
+      const_iterator& operator++() {
+        check(_item != nullptr, "cannot increment end iterator");
+        uint64_t next;
+        if( db().db_upperbound(_multidx->table(), _item->primary_key(), next) ) _item = _multidx->load(next);
+        else _item = nullptr;
+        return *this;
+      }
+
+      const_iterator& operator--() {
+        uint64_t prev;
+        bool found = _item ? db().db_previous(_multidx->table(), _item->primary_key(), prev)
+                           : db().db_last(_multidx->table(), prev);
+        check(found, "cannot decrement iterator at beginning of table");
+        _item = _multidx->load(prev);
+        return *this;
+      }
+
+      friend bool operator==(const const_iterator& a, const const_iterator& b) { return a._item == b._item; }
+      friend bool operator!=(const const_iterator& a, const const_iterator& b) { return a._item != b._item; }
+
+    private:
+      friend class multi_index;
+      const_iterator(const multi_index* mi, const T* i = nullptr) : _multidx(mi), _item(i) {}
+
+      const multi_index* _multidx = nullptr;
+      const T* _item = nullptr;
+    };
+
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+
+    template<name::raw IndexName, typename Extractor, uint64_t Number>
+    class index {
+    public:
+      typedef typename Extractor::result_type secondary_key_type;
+
+      class const_iterator {
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() {}
+
+        const T& operator*() const {
+          check(_item != nullptr, "cannot dereference end iterator");
+          return *_item;
+        }
+        const T* operator->() const { return &operator*(); }
+
+        const_iterator operator++(int) { const_iterator r = *this; ++(*this); return r; }
+        const_iterator operator--(int) { const_iterator r = *this; --(*this); return r; }
+
+        const_iterator& operator++() {
+          check(_item != nullptr, "cannot increment end iterator");
+          secondary_key_type k;
+          uint64_t pk;
+          if( db().template idx_next<secondary_key_type>(_multidx->index_table(Number), Extractor()(*_item), _item->primary_key(), k, pk) )
+            _item = _multidx->load(pk);
+          else
+            _item = nullptr;
+          return *this;
+        }
+
+        const_iterator& operator--() {
+          secondary_key_type k{};
+          uint64_t pk = 0;
+          bool found = _item
+            ? db().template idx_previous<secondary_key_type>(_multidx->index_table(Number), Extractor()(*_item), _item->primary_key(), false, k, pk)
+            : db().template idx_previous<secondary_key_type>(_multidx->index_table(Number), k, pk, true, k, pk);
+          check(found, "cannot decrement iterator at beginning of index");
+          _item = _multidx->load(pk);
+          return *this;
+        }
+
+        friend bool operator==(const const_iterator& a, const const_iterator& b) { return a._item == b._item; }
+        friend bool operator!=(const const_iterator& a, const const_iterator& b) { return a._item != b._item; }
+
+      private:
+        friend class index;
+        const_iterator(const multi_index* mi, const T* i = nullptr) : _multidx(mi), _item(i) {}
+
+        const multi_index* _multidx = nullptr;
+        const T* _item = nullptr;
+      };
+
+      typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+      static constexpr uint64_t name() { return static_cast<uint64_t>(IndexName); }
+      static constexpr uint64_t number() { return Number; }
+
+      const_iterator cbegin() const { return lower_bound(std::numeric_limits<secondary_key_type>::lowest()); }
+      const_iterator begin() const { return cbegin(); }
+      const_iterator cend() const { return const_iterator(_multidx); }
+      const_iterator end() const { return cend(); }
+      const_reverse_iterator crbegin() const { return std::make_reverse_iterator(cend()); }
+      const_reverse_iterator rbegin() const { return crbegin(); }
+      const_reverse_iterator crend() const { return std::make_reverse_iterator(cbegin()); }
+      const_reverse_iterator rend() const { return crend(); }
+
+      const_iterator find(secondary_key_type secondary) const {
+        auto lb = lower_bound(secondary);
+        if( lb == end() || Extractor()(*lb) != secondary ) return end();
+        return lb;
+      }
+
+      const_iterator require_find(secondary_key_type secondary, const char* error_msg = "unable to find secondary key") const {
+        auto lb = find(secondary);
+        check(lb != end(), error_msg);
+        return lb;
+      }
+
+      const T& get(secondary_key_type secondary, const char* error_msg = "unable to find secondary key") const {
+        return *require_find(secondary, error_msg);
+      }
+
+      const_iterator lower_bound(secondary_key_type secondary) const {
+        secondary_key_type k;
+        uint64_t pk;
+        if( !db().template idx_lowerbound<secondary_key_type>(table(), secondary, 0, k, pk) ) return end();
+        return const_iterator(_multidx, _multidx->load(pk));
+      }
+
+      const_iterator upper_bound(secondary_key_type secondary) const {
+        secondary_key_type k;
+        uint64_t pk;
+        if( !db().template idx_next<secondary_key_type>(table(), secondary, std::numeric_limits<uint64_t>::max(), k, pk) ) return end();
+        return const_iterator(_multidx, _multidx->load(pk));
+      }
+
+      const_iterator iterator_to(const T& obj) const {
+        return const_iterator(_multidx, &_multidx->owned(obj, "object passed to iterator_to is not in multi_index"));
+      }
+
+      template<typename Lambda>
+      void modify(const_iterator itr, eosio::name payer, Lambda&& updater) {
+        check(itr != end(), "cannot pass end iterator to modify");
+        _multidx->modify(*itr, payer, std::forward<Lambda>(updater));
+      }
+
+      const_iterator erase(const_iterator itr) {
+        check(itr != end(), "cannot pass end iterator to erase");
+        const T& obj = *itr;
+        ++itr;
+        _multidx->erase(obj);
+        return itr;
+      }
+
+      eosio::name get_code() const { return _multidx->get_code(); }
+      uint64_t get_scope() const { return _multidx->get_scope(); }
+
+      static auto extract_secondary_key(const T& obj) { return Extractor()(obj); }
+
+    private:
+      friend class multi_index;
+      index(const multi_index* midx) : _multidx(const_cast<multi_index*>(midx)) {}
+
+      native::table_id table() const { return _multidx->index_table(Number); }
+
+      multi_index* _multidx;
+    };
+
+
+    multi_index(name code, uint64_t scope) : _code(code), _scope(scope) {}
+
+    multi_index(const multi_index&) = delete;
+    multi_index& operator=(const multi_index&) = delete;
+
+    name get_code() const { return _code; }
+    uint64_t get_scope() const { return _scope; }
+
+    const_iterator cbegin() const { return lower_bound(std::numeric_limits<uint64_t>::lowest()); }
+    const_iterator begin() const { return cbegin(); }
+    const_iterator cend() const { return const_iterator(this); }
+    const_iterator end() const { return cend(); }
+    const_reverse_iterator crbegin() const { return std::make_reverse_iterator(cend()); }
+    const_reverse_iterator rbegin() const { return crbegin(); }
+    const_reverse_iterator crend() const { return std::make_reverse_iterator(cbegin()); }
+    const_reverse_iterator rend() const { return crend(); }
+
+    const_iterator lower_bound(uint64_t primary) const {
+      uint64_t pk;
+      if( !db().db_lowerbound(table(), primary, pk) ) return end();
+      return const_iterator(this, load(pk));
+    }
+
+    const_iterator upper_bound(uint64_t primary) const {
+      uint64_t pk;
+      if( !db().db_upperbound(table(), primary, pk) ) return end();
+      return const_iterator(this, load(pk));
+    }
+
+    uint64_t available_primary_key() const {
+      if( _next_primary_key == unset_next_primary_key ) {
+        uint64_t last;
+        if( db().db_last(table(), last) ) {
+          _next_primary_key = (last >= no_available_primary_key) ? no_available_primary_key : last + 1;
+        }
+        else {
+          _next_primary_key = 0;
+        }
+      }
+      check(_next_primary_key < no_available_primary_key, "next primary key in table is at autoincrement limit");
+      return _next_primary_key;
+    }
+
+    template<name::raw IndexName>
+    auto get_index() {
+      constexpr size_t I = find_index<static_cast<uint64_t>(IndexName)>();
+      using idx = index<IndexName, typename index_type<I>::secondary_extractor_type, I>;
+      return idx(this);
+    }
+
+    template<name::raw IndexName>
+    auto get_index() const {
+      constexpr size_t I = find_index<static_cast<uint64_t>(IndexName)>();
+      using idx = index<IndexName, typename index_type<I>::secondary_extractor_type, I>;
+      return idx(this);
+    }
+
+    const_iterator iterator_to(const T& obj) const {
+      return const_iterator(this, &owned(obj, "object passed to iterator_to is not in multi_index"));
+    }
+
+    template<typename Lambda>
+    const_iterator emplace(name payer, Lambda&& constructor) {
+      check(_code == current_receiver(), "cannot create objects in table of another contract");
+      auto obj = std::make_unique<T>();
+      constructor(*obj);
+      uint64_t pk = obj->primary_key();
+      db().db_store(table(), pk, payer, pack(*obj));
+      for_each_index([&](auto i) {
+          db().template idx_store<key_type<decltype(i)::value>>(index_table(i), pk, payer, extract<decltype(i)::value>(*obj));
+        });
+      if( pk >= _next_primary_key ) {
+        _next_primary_key = (pk >= no_available_primary_key) ? no_available_primary_key : pk + 1;
+      }
+      auto ptr = obj.get();
+      _items[pk] = std::move(obj);
+      return const_iterator(this, ptr);
+    }
+
+    template<typename Lambda>
+    void modify(const_iterator itr, name payer, Lambda&& updater) {
+      check(itr != end(), "cannot pass end iterator to modify");
+      modify(*itr, payer, std::forward<Lambda>(updater));
+    }
+
+    template<typename Lambda>
+    void modify(const T& obj, name payer, Lambda&& updater) {
+      check(_code == current_receiver(), "cannot modify objects in table of another contract");
+      T& mutableobj = const_cast<T&>(owned(obj, "object passed to modify is not in multi_index"));
+      uint64_t pk = mutableobj.primary_key();
+
+      auto old_keys = std::make_tuple(typename Indices::secondary_extractor_type::result_type()...);
+      for_each_index([&](auto i) { std::get<decltype(i)::value>(old_keys) = extract<decltype(i)::value>(mutableobj); });
+
+      updater(mutableobj);
+      check(pk == mutableobj.primary_key(), "updater cannot change primary key when modifying an object");
+
+      db().db_update(table(), pk, payer, pack(mutableobj));
+      for_each_index([&](auto i) {
+          auto k = extract<decltype(i)::value>(mutableobj);
+          if( k != std::get<decltype(i)::value>(old_keys) ) {
+            db().template idx_update<key_type<decltype(i)::value>>(index_table(i), pk, payer, k);
+          }
+        });
+      if( pk >= _next_primary_key ) {
+        _next_primary_key = (pk >= no_available_primary_key) ? no_available_primary_key : pk + 1;
+      }
+    }
+
+    const T& get(uint64_t primary, const char* error_msg = "unable to find key") const {
+      auto result = find(primary);
+      check(result != cend(), error_msg);
+      return *result;
+    }
+
+    const_iterator find(uint64_t primary) const {
+      if( auto c = cached(primary) ) return const_iterator(this, c);
+      auto r = db().db_get(table(), primary);
+      if( r == nullptr ) return end();
+      auto obj = std::make_unique<T>(unpack<T>(r->data));
+      auto ptr = obj.get();
+      _items.emplace(primary, std::move(obj));
+      return const_iterator(this, ptr);
+    }
+
+    const_iterator require_find(uint64_t primary, const char* error_msg = "unable to find key") const {
+      auto itr = find(primary);
+      check(itr != end(), error_msg);
+      return itr;
+    }
+
+    const_iterator erase(const_iterator itr) {
+      check(itr != end(), "cannot pass end iterator to erase");
+      const T& obj = *itr;
+      ++itr;
+      erase(obj);
+      return itr;
+    }
+
+    void erase(const T& obj) {
+      check(_code == current_receiver(), "cannot erase objects in table of another contract");
+      const T& o = owned(obj, "object passed to erase is not in multi_index");
+      uint64_t pk = o.primary_key();
+      db().db_remove(table(), pk);
+      for_each_index([&](auto i) {
+          db().template idx_remove<key_type<decltype(i)::value>>(index_table(i), pk);
+        });
+      _items.erase(pk);
+    }
+  };
+}
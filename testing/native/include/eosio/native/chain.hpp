@@ -0,0 +1,603 @@
+/*
+  In-memory chain used by the native simulation harness.
+
+  Holds the database (serialized rows plus secondary indexes, laid out
+  like nodeos does), the clock, accounts, the action context stack and
+  the deferred transaction queue. Every database and inline-action call
+  made by a contract is counted against the action that made it, so a
+  workload driver can report per-action cost.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <eosio/check.hpp>
+#include <eosio/name.hpp>
+#include <eosio/time.hpp>
+#include <eosio/datastream.hpp>
+
+namespace eosio { namespace native {
+
+  using bytes = std::vector<char>;
+
+  // RAM overheads nodeos bills on top of the serialized row
+  constexpr int64_t primary_row_overhead = 108;
+  constexpr int64_t secondary_row_overhead(size_t key_size) { return 24 + key_size + 96; }
+
+  struct table_id {
+    uint64_t code;
+    uint64_t scope;
+    uint64_t table;
+    auto operator<=>(const table_id&) const = default;
+  };
+
+  struct row {
+    bytes data;
+    name  payer;
+  };
+
+  struct secondary_base {
+    virtual ~secondary_base() = default;
+  };
+
+  template<typename K>
+  struct secondary_table : public secondary_base {
+    struct entry {
+      K    key;
+      name payer;
+    };
+    std::set<std::pair<K, uint64_t>> entries;
+    std::map<uint64_t, entry> keys;
+  };
+
+  struct packed_action {
+    name account;
+    name action;
+    std::vector<std::pair<name, name>> authorization;
+    bytes data;
+  };
+
+
+  // Heap allocations so far, counted by a replacement operator new in the
+  // workload driver; stays 0 without one. Includes the allocations of
+  // the simulated database itself.
+  inline uint64_t heap_allocations = 0;
+
+
+  struct action_cost {
+    uint64_t calls = 0;
+    uint64_t failures = 0;
+    uint64_t db_reads = 0;
+    uint64_t db_writes = 0;
+    uint64_t row_bytes = 0;
+    int64_t  ram_delta = 0;
+    uint64_t inline_actions = 0;
+    uint64_t inline_bytes = 0;
+    uint64_t notifications = 0;
+    uint64_t deferred = 0;
+    uint64_t allocs = 0;
+    uint64_t wall_ns = 0;
+
+    void add(const action_cost& o) {
+      calls += o.calls;
+      failures += o.failures;
+      db_reads += o.db_reads;
+      db_writes += o.db_writes;
+      row_bytes += o.row_bytes;
+      ram_delta += o.ram_delta;
+      inline_actions += o.inline_actions;
+      inline_bytes += o.inline_bytes;
+      notifications += o.notifications;
+      deferred += o.deferred;
+      allocs += o.allocs;
+      wall_ns += o.wall_ns;
+    }
+  };
+
+
+  class chain {
+  public:
+    using apply_handler = std::function<void(name receiver, name code, name action)>;
+    using trace_handler = std::function<void(uint64_t global_sequence, time_point block_time,
+                                             const packed_action& act)>;
+
+    struct action_context {
+      name receiver;
+      const packed_action* act;
+      std::vector<name> notified;
+      std::vector<packed_action> inlines;
+      action_cost cost;
+    };
+
+    struct deferred_transaction {
+      name sender;
+      unsigned __int128 sender_id;
+      name payer;
+      time_point execute_at;
+      uint64_t seq;
+      std::vector<packed_action> actions;
+    };
+
+    static chain& instance() {
+      static chain c;
+      return c;
+    }
+
+    // ---------------------------------------------------------------- setup
+
+    void create_account(name a) { _accounts.insert(a.value); }
+    bool is_account(name a) const { return _accounts.count(a.value) > 0; }
+    void set_code(name a, apply_handler h) { create_account(a); _code[a.value] = std::move(h); }
+
+    // Receives every action executed by its own contract, in execution
+    // order, once the transaction is committed
+    void set_trace_handler(trace_handler h) { _trace_handler = std::move(h); }
+
+    // Drops all tables, deferred transactions and statistics, keeping
+    // accounts and contract code
+    void reset_state() {
+      check(!_in_transaction, "cannot reset inside a transaction");
+      _primary.clear();
+      _secondary.clear();
+      _ram.clear();
+      _deferred.clear();
+      _now = time_point(seconds(genesis_time));
+      reset_stats();
+    }
+
+    time_point now() const { return _now; }
+    void set_time(time_point t) { _now = t; }
+    void advance(microseconds m) { _now += m; }
+
+    // ---------------------------------------------------------------- transactions
+
+    // Runs all actions atomically. On a failed check the database,
+    // deferred queue and RAM usage are restored and false is returned.
+    bool push_transaction(const std::vector<packed_action>& actions) {
+      check(!_in_transaction, "nested transaction");
+      _in_transaction = true;
+      _tx_seq++;
+      _tx_bytes = pack(std::make_tuple(_tx_seq, _now.sec_since_epoch(), actions));
+      _pending.clear();
+      _failed_action.clear();
+      bool ok = true;
+      try {
+        for( const auto& a : actions ) {
+          exec(a, a.account, 0);
+        }
+      }
+      catch( const check_failure& e ) {
+        ok = false;
+        _last_error = e.what();
+      }
+
+      if( ok ) {
+        for( auto& p : _pending ) {
+          _stats[p.first].add(p.second);
+        }
+        if( _trace_handler ) {
+          for( const auto& t : _traces ) {
+            _trace_handler(++_global_sequence, _now, t);
+          }
+        }
+      }
+      else {
+        for( auto itr = _undo.rbegin(); itr != _undo.rend(); ++itr ) {
+          (*itr)();
+        }
+        _stats[_failed_action].failures++;
+        _errors[_last_error]++;
+        _ctx.clear();
+      }
+      _undo.clear();
+      _pending.clear();
+      _traces.clear();
+      _in_transaction = false;
+      return ok;
+    }
+
+    template<typename... Args>
+    bool push_action(name account, name action, name actor, Args&&... args) {
+      packed_action a{account, action, {{actor, name("active")}}, pack(std::make_tuple(std::forward<Args>(args)...))};
+      return push_transaction({a});
+    }
+
+    // Executes every deferred transaction that is due. Returns the number executed.
+    size_t run_deferred() {
+      size_t executed = 0;
+      while( true ) {
+        auto itr = _deferred.end();
+        for( auto i = _deferred.begin(); i != _deferred.end(); ++i ) {
+          if( i->second.execute_at <= _now &&
+              (itr == _deferred.end() || i->second.seq < itr->second.seq) ) {
+            itr = i;
+          }
+        }
+        if( itr == _deferred.end() ) break;
+        auto actions = std::move(itr->second.actions);
+        _deferred.erase(itr);
+        push_transaction(actions);
+        executed++;
+      }
+      return executed;
+    }
+
+    size_t deferred_pending() const { return _deferred.size(); }
+
+    // ---------------------------------------------------------------- action context
+
+    action_context& context() {
+      check(!_ctx.empty(), "no action is executing");
+      return _ctx.back();
+    }
+
+    name current_receiver() { return context().receiver; }
+    const bytes& action_data() { return context().act->data; }
+
+    bool has_auth(name n) {
+      for( const auto& p : context().act->authorization ) {
+        if( p.first == n ) return true;
+      }
+      return false;
+    }
+
+    void require_recipient(name n) {
+      auto& ctx = context();
+      for( auto r : ctx.notified ) {
+        if( r == n ) return;
+      }
+      ctx.notified.push_back(n);
+      ctx.cost.notifications++;
+    }
+
+    void send_inline(packed_action a) {
+      auto& ctx = context();
+      ctx.cost.inline_actions++;
+      ctx.cost.inline_bytes += a.data.size();
+      ctx.inlines.push_back(std::move(a));
+    }
+
+    void send_deferred(unsigned __int128 sender_id, name payer, uint32_t delay_sec,
+                       std::vector<packed_action> actions, bool replace_existing) {
+      auto& ctx = context();
+      auto key = std::make_pair(ctx.receiver.value, sender_id);
+      auto itr = _deferred.find(key);
+      check(itr == _deferred.end() || replace_existing,
+            "deferred transaction with the same sender_id and payer already exists");
+      std::optional<deferred_transaction> prev;
+      if( itr != _deferred.end() ) prev = itr->second;
+      _deferred[key] = deferred_transaction{ctx.receiver, sender_id, payer,
+                                            _now + seconds(delay_sec), ++_deferred_seq, std::move(actions)};
+      ctx.cost.deferred++;
+      _undo.push_back([this, key, prev]() {
+          if( prev ) _deferred[key] = *prev;
+          else _deferred.erase(key);
+        });
+    }
+
+    const bytes& transaction_bytes() const { return _tx_bytes; }
+
+    // ---------------------------------------------------------------- primary tables
+
+    const row* db_get(const table_id& t, uint64_t pk) {
+      context().cost.db_reads++;
+      auto ti = _primary.find(t);
+      if( ti == _primary.end() ) return nullptr;
+      auto ri = ti->second.find(pk);
+      return ri == ti->second.end() ? nullptr : &ri->second;
+    }
+
+    bool db_lowerbound(const table_id& t, uint64_t pk, uint64_t& out) {
+      context().cost.db_reads++;
+      auto ti = _primary.find(t);
+      if( ti == _primary.end() ) return false;
+      auto ri = ti->second.lower_bound(pk);
+      if( ri == ti->second.end() ) return false;
+      out = ri->first;
+      return true;
+    }
+
+    bool db_upperbound(const table_id& t, uint64_t pk, uint64_t& out) {
+      context().cost.db_reads++;
+      auto ti = _primary.find(t);
+      if( ti == _primary.end() ) return false;
+      auto ri = ti->second.upper_bound(pk);
+      if( ri == ti->second.end() ) return false;
+      out = ri->first;
+      return true;
+    }
+
+    bool db_previous(const table_id& t, uint64_t pk, uint64_t& out) {
+      context().cost.db_reads++;
+      auto ti = _primary.find(t);
+      if( ti == _primary.end() ) return false;
+      auto ri = ti->second.lower_bound(pk);
+      if( ri == ti->second.begin() ) return false;
+      --ri;
+      out = ri->first;
+      return true;
+    }
+
+    bool db_last(const table_id& t, uint64_t& out) {
+      context().cost.db_reads++;
+      auto ti = _primary.find(t);
+      if( ti == _primary.end() || ti->second.empty() ) return false;
+      out = ti->second.rbegin()->first;
+      return true;
+    }
+
+    void db_store(const table_id& t, uint64_t pk, name payer, bytes data) {
+      auto& tbl = _primary[t];
+      check(tbl.find(pk) == tbl.end(),
+            "could not insert object, most likely a uniqueness constraint was violated");
+      write_cost(data.size(), primary_row_overhead + (int64_t)data.size(), payer);
+      tbl.emplace(pk, row{std::move(data), payer});
+      _undo.push_back([this, t, pk]() {
+          auto& r = _primary[t][pk];
+          bill(r.payer, -(primary_row_overhead + (int64_t)r.data.size()));
+          _primary[t].erase(pk);
+        });
+    }
+
+    void db_update(const table_id& t, uint64_t pk, name payer, bytes data) {
+      auto& r = _primary[t].at(pk);
+      row old = r;
+      if( !payer ) payer = old.payer;
+      bill(old.payer, -(primary_row_overhead + (int64_t)old.data.size()));
+      write_cost(data.size(), primary_row_overhead + (int64_t)data.size(), payer);
+      context().cost.ram_delta -= primary_row_overhead + (int64_t)old.data.size();
+      r.data = std::move(data);
+      r.payer = payer;
+      _undo.push_back([this, t, pk, old]() {
+          auto& cur = _primary[t][pk];
+          bill(cur.payer, -(primary_row_overhead + (int64_t)cur.data.size()));
+          bill(old.payer, primary_row_overhead + (int64_t)old.data.size());
+          cur = old;
+        });
+    }
+
+    void db_remove(const table_id& t, uint64_t pk) {
+      auto& tbl = _primary[t];
+      auto ri = tbl.find(pk);
+      check(ri != tbl.end(), "db_remove: row does not exist");
+      row old = std::move(ri->second);
+      tbl.erase(ri);
+      int64_t sz = primary_row_overhead + (int64_t)old.data.size();
+      context().cost.db_writes++;
+      context().cost.ram_delta -= sz;
+      bill(old.payer, -sz);
+      _undo.push_back([this, t, pk, old, sz]() {
+          _primary[t].emplace(pk, old);
+          bill(old.payer, sz);
+        });
+    }
+
+    // ---------------------------------------------------------------- secondary indexes
+
+    template<typename K>
+    secondary_table<K>& secondary(const table_id& t) {
+      auto& p = _secondary[t];
+      if( !p ) p = std::make_unique<secondary_table<K>>();
+      auto* s = dynamic_cast<secondary_table<K>*>(p.get());
+      check(s != nullptr, "secondary index key type mismatch");
+      return *s;
+    }
+
+    template<typename K>
+    void idx_store(const table_id& t, uint64_t pk, name payer, const K& key) {
+      auto& s = secondary<K>(t);
+      s.entries.emplace(key, pk);
+      s.keys[pk] = {key, payer};
+      int64_t sz = secondary_row_overhead(sizeof(K));
+      write_cost(0, sz, payer);
+      _undo.push_back([this, t, pk, key, payer, sz]() {
+          auto& s = secondary<K>(t);
+          s.entries.erase(std::make_pair(key, pk));
+          s.keys.erase(pk);
+          bill(payer, -sz);
+        });
+    }
+
+    template<typename K>
+    void idx_update(const table_id& t, uint64_t pk, name payer, const K& key) {
+      auto& s = secondary<K>(t);
+      auto old = s.keys.at(pk);
+      if( !payer ) payer = old.payer;
+      s.entries.erase(std::make_pair(old.key, pk));
+      s.entries.emplace(key, pk);
+      s.keys[pk] = {key, payer};
+      int64_t sz = secondary_row_overhead(sizeof(K));
+      bill(old.payer, -sz);
+      bill(payer, sz);
+      context().cost.db_writes++;
+      _undo.push_back([this, t, pk, key, payer, old, sz]() {
+          auto& s = secondary<K>(t);
+          s.entries.erase(std::make_pair(key, pk));
+          s.entries.emplace(old.key, pk);
+          s.keys[pk] = old;
+          bill(payer, -sz);
+          bill(old.payer, sz);
+        });
+    }
+
+    template<typename K>
+    void idx_remove(const table_id& t, uint64_t pk) {
+      auto& s = secondary<K>(t);
+      auto old = s.keys.at(pk);
+      s.entries.erase(std::make_pair(old.key, pk));
+      s.keys.erase(pk);
+      int64_t sz = secondary_row_overhead(sizeof(K));
+      context().cost.db_writes++;
+      context().cost.ram_delta -= sz;
+      bill(old.payer, -sz);
+      _undo.push_back([this, t, pk, old, sz]() {
+          auto& s = secondary<K>(t);
+          s.entries.emplace(old.key, pk);
+          s.keys[pk] = old;
+          bill(old.payer, sz);
+        });
+    }
+
+    // First entry not less than (key, pk)
+    template<typename K>
+    bool idx_lowerbound(const table_id& t, const K& key, uint64_t pk, K& out_key, uint64_t& out_pk) {
+      context().cost.db_reads++;
+      auto& s = secondary<K>(t);
+      auto i = s.entries.lower_bound(std::make_pair(key, pk));
+      if( i == s.entries.end() ) return false;
+      out_key = i->first;
+      out_pk = i->second;
+      return true;
+    }
+
+    // First entry strictly after (key, pk)
+    template<typename K>
+    bool idx_next(const table_id& t, const K& key, uint64_t pk, K& out_key, uint64_t& out_pk) {
+      context().cost.db_reads++;
+      auto& s = secondary<K>(t);
+      auto i = s.entries.upper_bound(std::make_pair(key, pk));
+      if( i == s.entries.end() ) return false;
+      out_key = i->first;
+      out_pk = i->second;
+      return true;
+    }
+
+    // Last entry strictly before (key, pk), or the last entry at all if at_end
+    template<typename K>
+    bool idx_previous(const table_id& t, const K& key, uint64_t pk, bool at_end, K& out_key, uint64_t& out_pk) {
+      context().cost.db_reads++;
+      auto& s = secondary<K>(t);
+      auto i = at_end ? s.entries.end() : s.entries.lower_bound(std::make_pair(key, pk));
+      if( i == s.entries.begin() ) return false;
+      --i;
+      out_key = i->first;
+      out_pk = i->second;
+      return true;
+    }
+
+    template<typename K>
+    bool idx_find_primary(const table_id& t, uint64_t pk, K& out_key) {
+      context().cost.db_reads++;
+      auto& s = secondary<K>(t);
+      auto i = s.keys.find(pk);
+      if( i == s.keys.end() ) return false;
+      out_key = i->second.key;
+      return true;
+    }
+
+    // ---------------------------------------------------------------- reporting
+
+    const std::map<std::string, action_cost>& stats() const { return _stats; }
+    const std::map<std::string, uint64_t>& errors() const { return _errors; }
+    const std::string& last_error() const { return _last_error; }
+    void reset_stats() { _stats.clear(); _errors.clear(); }
+
+    int64_t ram_usage(name payer) const {
+      auto i = _ram.find(payer.value);
+      return i == _ram.end() ? 0 : i->second;
+    }
+
+    int64_t ram_total() const {
+      int64_t total = 0;
+      for( const auto& r : _ram ) total += r.second;
+      return total;
+    }
+
+    size_t row_count(name code, name table) const {
+      size_t n = 0;
+      for( const auto& t : _primary ) {
+        if( t.first.code == code.value && t.first.table == table.value ) n += t.second.size();
+      }
+      return n;
+    }
+
+  private:
+    static constexpr int64_t genesis_time = 1549324800;
+
+    chain() : _now(seconds(genesis_time)) {}
+
+    void bill(name payer, int64_t delta) {
+      _ram[payer.value] += delta;
+    }
+
+    void write_cost(size_t row_bytes, int64_t ram, name payer) {
+      auto& c = context().cost;
+      c.db_writes++;
+      c.row_bytes += row_bytes;
+      c.ram_delta += ram;
+      bill(payer, ram);
+    }
+
+    void exec(const packed_action& a, name receiver, int depth) {
+      check(depth < 16, "max inline action depth per transaction reached");
+      auto h = _code.find(receiver.value);
+      if( h == _code.end() ) {
+        // plain accounts ignore notifications; inline actions need a contract
+        check(receiver != a.account, "account " + receiver.to_string() + " has no contract code");
+        return;
+      }
+      _ctx.push_back(action_context{receiver, &a, {}, {}, {}});
+      std::string key = receiver.to_string() + "::" + a.action.to_string();
+      _failed_action = key;
+
+      uint64_t allocs = heap_allocations;
+      auto start = std::chrono::steady_clock::now();
+      h->second(receiver, a.account, a.action);
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      allocs = heap_allocations - allocs;
+
+      action_context ctx = std::move(_ctx.back());
+      _ctx.pop_back();
+      ctx.cost.calls = 1;
+      ctx.cost.allocs = allocs;
+      ctx.cost.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+      _pending.emplace_back(key, ctx.cost);
+      if( _trace_handler && receiver == a.account ) {
+        _traces.push_back(a);
+      }
+
+      for( auto r : ctx.notified ) {
+        if( r != receiver ) exec(a, r, depth);
+      }
+      for( const auto& i : ctx.inlines ) {
+        exec(i, i.account, depth + 1);
+      }
+    }
+
+    time_point _now;
+    std::set<uint64_t> _accounts;
+    std::map<uint64_t, apply_handler> _code;
+
+    std::map<table_id, std::map<uint64_t, row>> _primary;
+    std::map<table_id, std::unique_ptr<secondary_base>> _secondary;
+    std::map<uint64_t, int64_t> _ram;
+
+    std::map<std::pair<uint64_t, unsigned __int128>, deferred_transaction> _deferred;
+    uint64_t _deferred_seq = 0;
+
+    bool _in_transaction = false;
+    uint64_t _tx_seq = 0;
+    bytes _tx_bytes;
+    std::vector<action_context> _ctx;
+    std::vector<std::function<void()>> _undo;
+    std::vector<std::pair<std::string, action_cost>> _pending;
+    std::vector<packed_action> _traces;
+    trace_handler _trace_handler;
+    uint64_t _global_sequence = 0;
+    std::string _failed_action;
+    std::string _last_error;
+
+    std::map<std::string, action_cost> _stats;
+    std::map<std::string, uint64_t> _errors;
+  };
+}}
@@ -0,0 +1,106 @@
+/*
+  Field reflection for plain aggregates.
+
+  The real CDT serializes table rows and action structs field by field
+  with boost::pfr; this is the same idea reduced to what the contract
+  needs: count the fields of an aggregate and visit them in declaration
+  order through a structured binding.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace eosio { namespace native {
+
+  struct any_field {
+    template<typename T> operator T() const;
+  };
+
+  template<typename T, std::size_t... I>
+  constexpr bool brace_constructible(std::index_sequence<I...>) {
+    return requires { T{ (void(I), any_field{})... }; };
+  }
+
+  constexpr std::size_t max_reflected_fields = 32;
+
+  template<typename T, std::size_t N = 0>
+  constexpr std::size_t field_count() {
+    if constexpr( N > max_reflected_fields ) {
+      return N;
+    }
+    else if constexpr( brace_constructible<T>(std::make_index_sequence<N + 1>{}) ) {
+      return field_count<T, N + 1>();
+    }
+    else {
+      return N;
+    }
+  }
+
+  template<typename T>
+  concept reflectable = std::is_aggregate_v<std::remove_cvref_t<T>> &&
+    !std::is_array_v<std::remove_cvref_t<T>> &&
+    field_count<std::remove_cvref_t<T>>() <= max_reflected_fields;
+
+
+#define EOSIO_NATIVE_FIELDS_1  f0
+#define EOSIO_NATIVE_FIELDS_2  EOSIO_NATIVE_FIELDS_1, f1
+#define EOSIO_NATIVE_FIELDS_3  EOSIO_NATIVE_FIELDS_2, f2
+#define EOSIO_NATIVE_FIELDS_4  EOSIO_NATIVE_FIELDS_3, f3
+#define EOSIO_NATIVE_FIELDS_5  EOSIO_NATIVE_FIELDS_4, f4
+#define EOSIO_NATIVE_FIELDS_6  EOSIO_NATIVE_FIELDS_5, f5
+#define EOSIO_NATIVE_FIELDS_7  EOSIO_NATIVE_FIELDS_6, f6
+#define EOSIO_NATIVE_FIELDS_8  EOSIO_NATIVE_FIELDS_7, f7
+#define EOSIO_NATIVE_FIELDS_9  EOSIO_NATIVE_FIELDS_8, f8
+#define EOSIO_NATIVE_FIELDS_10 EOSIO_NATIVE_FIELDS_9, f9
+#define EOSIO_NATIVE_FIELDS_11 EOSIO_NATIVE_FIELDS_10, f10
+#define EOSIO_NATIVE_FIELDS_12 EOSIO_NATIVE_FIELDS_11, f11
+#define EOSIO_NATIVE_FIELDS_13 EOSIO_NATIVE_FIELDS_12, f12
+#define EOSIO_NATIVE_FIELDS_14 EOSIO_NATIVE_FIELDS_13, f13
+#define EOSIO_NATIVE_FIELDS_15 EOSIO_NATIVE_FIELDS_14, f14
+#define EOSIO_NATIVE_FIELDS_16 EOSIO_NATIVE_FIELDS_15, f15
+#define EOSIO_NATIVE_FIELDS_17 EOSIO_NATIVE_FIELDS_16, f16
+#define EOSIO_NATIVE_FIELDS_18 EOSIO_NATIVE_FIELDS_17, f17
+#define EOSIO_NATIVE_FIELDS_19 EOSIO_NATIVE_FIELDS_18, f18
+#define EOSIO_NATIVE_FIELDS_20 EOSIO_NATIVE_FIELDS_19, f19
+#define EOSIO_NATIVE_FIELDS_21 EOSIO_NATIVE_FIELDS_20, f20
+#define EOSIO_NATIVE_FIELDS_22 EOSIO_NATIVE_FIELDS_21, f21
+#define EOSIO_NATIVE_FIELDS_23 EOSIO_NATIVE_FIELDS_22, f22
+#define EOSIO_NATIVE_FIELDS_24 EOSIO_NATIVE_FIELDS_23, f23
+#define EOSIO_NATIVE_FIELDS_25 EOSIO_NATIVE_FIELDS_24, f24
+#define EOSIO_NATIVE_FIELDS_26 EOSIO_NATIVE_FIELDS_25, f25
+#define EOSIO_NATIVE_FIELDS_27 EOSIO_NATIVE_FIELDS_26, f26
+#define EOSIO_NATIVE_FIELDS_28 EOSIO_NATIVE_FIELDS_27, f27
+#define EOSIO_NATIVE_FIELDS_29 EOSIO_NATIVE_FIELDS_28, f28
+#define EOSIO_NATIVE_FIELDS_30 EOSIO_NATIVE_FIELDS_29, f29
+#define EOSIO_NATIVE_FIELDS_31 EOSIO_NATIVE_FIELDS_30, f30
+#define EOSIO_NATIVE_FIELDS_32 EOSIO_NATIVE_FIELDS_31, f31
+
+#define EOSIO_NATIVE_VISIT(N)                                     \
+  else if constexpr( n == N ) {                                   \
+    auto& [EOSIO_NATIVE_FIELDS_##N] = v;                          \
+    [&](auto&... f) { (visitor(f), ...); }(EOSIO_NATIVE_FIELDS_##N); \
+  }
+
+  // Calls visitor(field) for every field of v, in declaration order
+  template<typename T, typename Visitor>
+  void for_each_field(T& v, Visitor&& visitor) {
+    constexpr std::size_t n = field_count<std::remove_cv_t<T>>();
+    if constexpr( n == 0 ) {}
+    EOSIO_NATIVE_VISIT(1)  EOSIO_NATIVE_VISIT(2)  EOSIO_NATIVE_VISIT(3)  EOSIO_NATIVE_VISIT(4)
+    EOSIO_NATIVE_VISIT(5)  EOSIO_NATIVE_VISIT(6)  EOSIO_NATIVE_VISIT(7)  EOSIO_NATIVE_VISIT(8)
+    EOSIO_NATIVE_VISIT(9)  EOSIO_NATIVE_VISIT(10) EOSIO_NATIVE_VISIT(11) EOSIO_NATIVE_VISIT(12)
+    EOSIO_NATIVE_VISIT(13) EOSIO_NATIVE_VISIT(14) EOSIO_NATIVE_VISIT(15) EOSIO_NATIVE_VISIT(16)
+    EOSIO_NATIVE_VISIT(17) EOSIO_NATIVE_VISIT(18) EOSIO_NATIVE_VISIT(19) EOSIO_NATIVE_VISIT(20)
+    EOSIO_NATIVE_VISIT(21) EOSIO_NATIVE_VISIT(22) EOSIO_NATIVE_VISIT(23) EOSIO_NATIVE_VISIT(24)
+    EOSIO_NATIVE_VISIT(25) EOSIO_NATIVE_VISIT(26) EOSIO_NATIVE_VISIT(27) EOSIO_NATIVE_VISIT(28)
+    EOSIO_NATIVE_VISIT(29) EOSIO_NATIVE_VISIT(30) EOSIO_NATIVE_VISIT(31) EOSIO_NATIVE_VISIT(32)
+    else {
+      static_assert(n <= max_reflected_fields, "too many fields to reflect");
+    }
+  }
+
+#undef EOSIO_NATIVE_VISIT
+}}
@@ -0,0 +1,31 @@
+/*
+  Native stand-in for <eosio/print.hpp>. Console output goes to stdout.
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <eosio/name.hpp>
+
+namespace eosio {
+
+  inline void printl(const char* ptr, size_t len) { fwrite(ptr, 1, len, stdout); }
+
+  inline void print(const char* ptr) { fputs(ptr, stdout); }
+  inline void print(const std::string& s) { printl(s.data(), s.size()); }
+  inline void print(name n) { print(n.to_string()); }
+
+  template<typename T>
+    requires std::is_integral_v<T>
+  void print(T num) { print(std::to_string(num)); }
+
+  template<typename Arg, typename Arg2, typename... Args>
+  void print(Arg&& a, Arg2&& b, Args&&... args) {
+    print(std::forward<Arg>(a));
+    print(std::forward<Arg2>(b), std::forward<Args>(args)...);
+  }
+}
@@ -0,0 +1,78 @@
+/*
+  Native stand-in for <eosio/singleton.hpp>.
+
+  Like the CDT version, the value is a single row whose primary key is
+  the table name. The row is cached after the first read, so get()
+  followed by set() costs one database read and one write.
+*/
+
+#pragma once
+
+#include <optional>
+
+#include <eosio/check.hpp>
+#include <eosio/datastream.hpp>
+#include <eosio/name.hpp>
+#include <eosio/system.hpp>
+#include <eosio/native/chain.hpp>
+
+namespace eosio {
+
+  template<name::raw SingletonName, typename T>
+  class singleton {
+    static constexpr uint64_t pk_value = static_cast<uint64_t>(SingletonName);
+
+    static native::chain& db() { return native::chain::instance(); }
+
+    native::table_id table() const { return {_code.value, _scope, pk_value}; }
+
+    const std::optional<T>& load() const {
+      if( !_loaded ) {
+        auto r = db().db_get(table(), pk_value);
+        if( r != nullptr ) _value = unpack<T>(r->data);
+        _loaded = true;
+      }
+      return _value;
+    }
+
+  public:
+    singleton(name code, uint64_t scope) : _code(code), _scope(scope) {}
+
+    bool exists() const { return load().has_value(); }
+
+    T get() const {
+      check(exists(), "singleton does not exist");
+      return *_value;
+    }
+
+    T get_or_default(const T& def = T()) const {
+      return exists() ? *_value : def;
+    }
+
+    T get_or_create(name bill_to_account, const T& def = T()) {
+      if( !exists() ) set(def, bill_to_account);
+      return *_value;
+    }
+
+    void set(const T& value, name bill_to_account) {
+      check(_code == current_receiver(), "cannot modify objects in table of another contract");
+      if( exists() ) db().db_update(table(), pk_value, bill_to_account, pack(value));
+      else db().db_store(table(), pk_value, bill_to_account, pack(value));
+      _value = value;
+    }
+
+    void remove() {
+      check(_code == current_receiver(), "cannot erase objects in table of another contract");
+      if( exists() ) {
+        db().db_remove(table(), pk_value);
+        _value.reset();
+      }
+    }
+
+  private:
+    name _code;
+    uint64_t _scope;
+    mutable bool _loaded = false;
+    mutable std::optional<T> _value;
+  };
+}
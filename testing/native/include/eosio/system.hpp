@@ -0,0 +1,24 @@
+/*
+  Native stand-in for <eosio/system.hpp>.
+*/
+
+#pragma once
+
+#include <eosio/name.hpp>
+#include <eosio/time.hpp>
+#include <eosio/native/chain.hpp>
+
+namespace eosio {
+
+  inline time_point current_time_point() {
+    return native::chain::instance().now();
+  }
+
+  inline bool is_account(name n) {
+    return native::chain::instance().is_account(n);
+  }
+
+  inline name current_receiver() {
+    return native::chain::instance().current_receiver();
+  }
+}
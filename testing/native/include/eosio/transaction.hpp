@@ -0,0 +1,62 @@
+/*
+  Native stand-in for <eosio/transaction.hpp>.
+
+  Deferred transactions are queued on the simulated chain and executed
+  when the harness calls chain::run_deferred() after their delay.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <eosio/action.hpp>
+#include <eosio/system.hpp>
+#include <eosio/time.hpp>
+#include <eosio/varint.hpp>
+#include <eosio/native/chain.hpp>
+
+namespace eosio {
+
+  typedef std::vector<std::pair<uint16_t, std::vector<char>>> extensions_type;
+
+  class transaction_header {
+  public:
+    transaction_header(time_point_sec exp = time_point_sec(current_time_point()) + 60)
+      : expiration(exp) {}
+
+    time_point_sec expiration;
+    uint16_t       ref_block_num = 0;
+    uint32_t       ref_block_prefix = 0;
+    unsigned_int   max_net_usage_words = 0UL;
+    uint8_t        max_cpu_usage_ms = 0UL;
+    unsigned_int   delay_sec = 0UL;
+  };
+
+  class transaction : public transaction_header {
+  public:
+    transaction(time_point_sec exp = time_point_sec(current_time_point()) + 60) : transaction_header(exp) {}
+
+    void send(const unsigned __int128& sender_id, name payer, bool replace_existing = false) const {
+      std::vector<native::packed_action> packed;
+      for( const auto& a : actions ) {
+        packed.push_back(a.to_packed());
+      }
+      native::chain::instance().send_deferred(sender_id, payer, delay_sec, std::move(packed), replace_existing);
+    }
+
+    std::vector<action>  context_free_actions;
+    std::vector<action>  actions;
+    extensions_type      transaction_extensions;
+  };
+
+  inline size_t transaction_size() {
+    return native::chain::instance().transaction_bytes().size();
+  }
+
+  inline size_t read_transaction(char* buffer, size_t size) {
+    const auto& tx = native::chain::instance().transaction_bytes();
+    size_t n = std::min(size, tx.size());
+    memcpy(buffer, tx.data(), n);
+    return n;
+  }
+}
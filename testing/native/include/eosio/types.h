@@ -0,0 +1,9 @@
+/*
+  Native stand-in for <eosio/types.h>: the 128-bit integer types the CDT
+  defines for secondary index keys.
+*/
+
+#pragma once
+
+typedef __int128 int128_t;
+typedef unsigned __int128 uint128_t;
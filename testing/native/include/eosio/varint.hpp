@@ -0,0 +1,22 @@
+/*
+  Native stand-in for <eosio/varint.hpp>.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace eosio {
+
+  struct unsigned_int {
+    unsigned_int(uint32_t v = 0) : value(v) {}
+
+    operator uint32_t() const { return value; }
+
+    unsigned_int& operator=(uint32_t v) { value = v; return *this; }
+
+    friend bool operator==(const unsigned_int& a, const unsigned_int& b) { return a.value == b.value; }
+
+    uint32_t value;
+  };
+}
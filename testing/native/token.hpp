@@ -0,0 +1,85 @@
+/*
+  Minimal eosio.token for the native simulation harness.
+
+  Balances live in the standard `accounts` table, so escrowescrow reads
+  them exactly as it would read a real token contract, and transfers
+  notify both parties the way eosio.token does.
+*/
+
+#pragma once
+
+#include <eosio/eosio.hpp>
+#include <eosio/multi_index.hpp>
+#include <eosio/asset.hpp>
+
+CONTRACT simtoken : public eosio::contract {
+ public:
+  using contract::contract;
+
+  // Credits an account out of thin air; only used to set up workloads
+  ACTION issue(eosio::name to, eosio::asset quantity)
+  {
+    eosio::require_auth(_self);
+    eosio::check(quantity.is_valid() && quantity.amount > 0, "invalid quantity");
+    _add_balance(to, quantity, _self);
+  }
+
+  ACTION transfer(eosio::name from, eosio::name to, eosio::asset quantity, std::string memo)
+  {
+    eosio::check(from != to, "cannot transfer to self");
+    eosio::require_auth(from);
+    eosio::check(eosio::is_account(to), "to account does not exist");
+    eosio::require_recipient(from);
+    eosio::require_recipient(to);
+    eosio::check(quantity.is_valid(), "invalid quantity");
+    eosio::check(quantity.amount > 0, "must transfer positive quantity");
+    eosio::check(memo.size() <= 256, "memo has more than 256 bytes");
+    _sub_balance(from, quantity);
+    _add_balance(to, quantity, from);
+  }
+
+  static void apply(eosio::name receiver, eosio::name code, eosio::name action)
+  {
+    if( code != receiver ) return;
+    if( action == eosio::name("transfer") ) {
+      eosio::execute_action(receiver, code, &simtoken::transfer);
+    } else if( action == eosio::name("issue") ) {
+      eosio::execute_action(receiver, code, &simtoken::issue);
+    } else {
+      eosio::check(false, "unknown action");
+    }
+  }
+
+ private:
+  struct account {
+    eosio::asset balance;
+    uint64_t primary_key() const { return balance.symbol.code().raw(); }
+  };
+
+  typedef eosio::multi_index<eosio::name("accounts"), account> accounts;
+
+  void _sub_balance(eosio::name owner, const eosio::asset& value)
+  {
+    accounts from_acnts(_self, owner.value);
+    const auto& from = from_acnts.get(value.symbol.code().raw(), "no balance object found");
+    eosio::check(from.balance.amount >= value.amount, "overdrawn balance");
+    from_acnts.modify(from, owner, [&]( auto& a ) {
+        a.balance -= value;
+      });
+  }
+
+  void _add_balance(eosio::name owner, const eosio::asset& value, eosio::name ram_payer)
+  {
+    accounts to_acnts(_self, owner.value);
+    auto to = to_acnts.find(value.symbol.code().raw());
+    if( to == to_acnts.end() ) {
+      to_acnts.emplace(ram_payer, [&]( auto& a ) {
+          a.balance = value;
+        });
+    } else {
+      to_acnts.modify(to, eosio::name(), [&]( auto& a ) {
+          a.balance += value;
+        });
+    }
+  }
+};